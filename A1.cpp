@@ -1,7 +1,12 @@
 #include "A1.hpp"
+#include "block_instance.hpp"
+#include "heightmap.hpp"
+#include "mesh.hpp"
 #include "cs488-framework/GlErrorCheck.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <cstddef>
 
 #include <imgui/imgui.h>
 #include <glm/glm.hpp>
@@ -15,16 +20,56 @@ static const size_t DIM = 16;
 static const size_t MAX_HEIGHT = 20;
 static const size_t NUM_COLOUR = 8;
 
+// Most simulation ticks run in one frame; a slower backlog is dropped.
+static const int MAX_TICKS_PER_FRAME = 64;
+
+// The active column's solid blocks and its outline skeleton (one taller
+// than the column).
+static const size_t MAX_INSTANCES = 2*MAX_HEIGHT + 1;
+
 //----------------------------------------------------------------------------------------
 // Constructor
-A1::A1()
+A1::A1( std::unique_ptr<Grid> grid )
     : current_col( 0 ),
     m_grid( DIM ),
-    m_rotating( false )
+    m_rotating( false ),
+    m_num_screenshots( 0 ),
+    m_export_scale( 1.0f ),
+    m_sim( DIM, MAX_HEIGHT ),
+    m_sim_mode( Simulation::OFF ),
+    m_tick_rate( 10.0f ),
+    m_tick_accum( 0.0 ),
+    m_last_logic( std::chrono::steady_clock::now() ),
+    m_stat_start( m_last_logic ),
+    m_stat_ticks( 0 ),
+    m_stat_cells( 0 ),
+    m_ticks_per_sec( 0.0f ),
+    m_cells_per_sec( 0.0f )
 
 {
     colour = new float[ NUM_COLOUR * 3 ];
     reset();
+
+    if ( grid ) {
+        for ( int z = 0; z < DIM; z++ ) {
+            for ( int x = 0; x < DIM; x++ ) {
+                m_grid.setHeight( x, z, grid->getHeight( x, z ) );
+                m_grid.setColour( x, z, grid->getColour( x, z ) );
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------
+std::unique_ptr<Grid> A1::importGrid( const std::string &heightmap,
+    const std::string &classes, std::string &error )
+{
+    std::unique_ptr<Grid> grid( new Grid( DIM ) );
+    if ( !importHeightmap( heightmap, classes, *grid, MAX_HEIGHT,
+            NUM_COLOUR, error ) ) {
+        grid.reset();
+    }
+    return grid;
 }
 
 //----------------------------------------------------------------------------------------
@@ -55,9 +100,11 @@ void A1::init()
     P_uni = m_shader.getUniformLocation( "P" );
     V_uni = m_shader.getUniformLocation( "V" );
     M_uni = m_shader.getUniformLocation( "M" );
-    col_uni = m_shader.getUniformLocation( "colour" );
+    offset_attr = m_shader.getAttribLocation( "offset" );
+    col_attr = m_shader.getAttribLocation( "colour" );
 
     initGrid();
+    m_exporter.init();
 
     // Set up initial view and projection matrices (need to do this here,
     // since it depends on the GLFW window being set up correctly).
@@ -78,27 +125,8 @@ void A1::initGrid()
      * Grid VBO, VAO setup
      */
 
-    size_t sz = 3 * 2 * 2 * (DIM+3);
-
-    float *verts = new float[ sz ];
-    size_t ct = 0;
-    for( int idx = 0; idx < DIM+3; ++idx ) {
-        verts[ ct ] = -1;
-        verts[ ct+1 ] = 0;
-        verts[ ct+2 ] = idx-1;
-        verts[ ct+3 ] = DIM+1;
-        verts[ ct+4 ] = 0;
-        verts[ ct+5 ] = idx-1;
-        ct += 6;
-
-        verts[ ct ] = idx-1;
-        verts[ ct+1 ] = 0;
-        verts[ ct+2 ] = -1;
-        verts[ ct+3 ] = idx-1;
-        verts[ ct+4 ] = 0;
-        verts[ ct+5 ] = DIM+1;
-        ct += 6;
-    }
+    std::vector<float> verts;
+    buildGridLines( DIM, verts );
 
     // Create the vertex array to record buffer assignments.
     glGenVertexArrays( 1, &m_grid_vao );
@@ -107,8 +135,8 @@ void A1::initGrid()
     // Create the grid vertex buffer
     glGenBuffers( 1, &m_grid_vbo );
     glBindBuffer( GL_ARRAY_BUFFER, m_grid_vbo );
-    glBufferData( GL_ARRAY_BUFFER, sz*sizeof(float),
-        verts, GL_STATIC_DRAW );
+    glBufferData( GL_ARRAY_BUFFER, verts.size()*sizeof(float),
+        verts.data(), GL_STATIC_DRAW );
 
     // Specify the means of extracting the position values properly.
     GLint posAttrib = m_shader.getAttribLocation( "position" );
@@ -202,9 +230,44 @@ void A1::initGrid()
     glEnableVertexAttribArray( posAttrib );
     glVertexAttribPointer( posAttrib, 3, GL_FLOAT, GL_FALSE, 0, nullptr );
 
+    // Block placement and colour advance once per instance; the pointers
+    // themselves are set every frame, see bindInstances().
+    m_stream.init( GL_ARRAY_BUFFER, MAX_INSTANCES * sizeof(BlockInstance) );
+    glEnableVertexAttribArray( offset_attr );
+    glVertexAttribDivisor( offset_attr, 1 );
+    glEnableVertexAttribArray( col_attr );
+    glVertexAttribDivisor( col_attr, 1 );
 
-    // OpenGL has the buffer now, there's no need for us to keep a copy.
-    delete [] verts;
+
+    glBindVertexArray( 0 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+    CHECK_GL_ERRORS;
+
+    /*
+     * Column VAO setup: the same cube, with instances coming from the
+     * culler's output buffer
+     */
+
+    m_culler.init( DIM, getAssetFilePath( "CullColumns.cs" ) );
+
+    glGenVertexArrays( 1, &m_column_vao );
+    glBindVertexArray( m_column_vao );
+
+    glBindBuffer( GL_ARRAY_BUFFER, m_cube_vbo );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m_cube_ebo );
+    glEnableVertexAttribArray( posAttrib );
+    glVertexAttribPointer( posAttrib, 3, GL_FLOAT, GL_FALSE, 0, nullptr );
+
+    glBindBuffer( GL_ARRAY_BUFFER, m_culler.getInstanceBuffer() );
+    glEnableVertexAttribArray( offset_attr );
+    glVertexAttribPointer( offset_attr, 4, GL_FLOAT, GL_FALSE,
+        sizeof(BlockInstance), (const GLvoid *)offsetof(BlockInstance, offset) );
+    glVertexAttribDivisor( offset_attr, 1 );
+    glEnableVertexAttribArray( col_attr );
+    glVertexAttribPointer( col_attr, 3, GL_FLOAT, GL_FALSE,
+        sizeof(BlockInstance), (const GLvoid *)offsetof(BlockInstance, colour) );
+    glVertexAttribDivisor( col_attr, 1 );
 
     glBindVertexArray( 0 );
     glBindBuffer( GL_ARRAY_BUFFER, 0 );
@@ -218,7 +281,49 @@ void A1::initGrid()
  */
 void A1::appLogic()
 {
-    // Place per frame, application logic here ...
+    using namespace std::chrono;
+
+    steady_clock::time_point now = steady_clock::now();
+    double dt = duration<double>( now - m_last_logic ).count();
+    m_last_logic = now;
+
+    // m_grid_dirty is cleared by every draw(), so if it is set here the
+    // user edited the grid since the last frame.
+    if ( m_grid_dirty ) {
+        m_sim.invalidate();
+    }
+
+    // Hold the simulation while exporting, so every exported frame shows
+    // the grid as it was when the export started.
+    m_sim.setMode( Simulation::Mode( m_sim_mode ) );
+    if ( m_sim.getMode() != Simulation::OFF && !m_exporter.isBusy() ) {
+        m_tick_accum += dt * m_tick_rate;
+
+        int ticks = 0;
+        while ( m_tick_accum >= 1.0 && ticks < MAX_TICKS_PER_FRAME ) {
+            if ( m_sim.step( m_grid ) ) {
+                m_grid_dirty = true;
+            }
+            m_stat_cells += m_sim.getCellsUpdated();
+            m_tick_accum -= 1.0;
+            ++ticks;
+        }
+        if ( ticks == MAX_TICKS_PER_FRAME ) {
+            m_tick_accum = 0.0;
+        }
+        m_stat_ticks += ticks;
+    } else {
+        m_tick_accum = 0.0;
+    }
+
+    double elapsed = duration<double>( now - m_stat_start ).count();
+    if ( elapsed >= 1.0 ) {
+        m_ticks_per_sec = m_stat_ticks / elapsed;
+        m_cells_per_sec = m_stat_cells / elapsed;
+        m_stat_ticks = 0;
+        m_stat_cells = 0;
+        m_stat_start = now;
+    }
 }
 
 //----------------------------------------------------------------------------------------
@@ -264,6 +369,7 @@ void A1::guiLogic()
             if( ImGui::RadioButton( "##Col", &current_col, i ) ) {
                 // Select this colour.
                 m_grid.setColour( m_active_x, m_active_z, current_col );
+                m_grid_dirty = true;
             }
             ImGui::PopID();
         }
@@ -279,6 +385,59 @@ void A1::guiLogic()
 */
 
         ImGui::Text( "Framerate: %.1f FPS", ImGui::GetIO().Framerate );
+        ImGui::Text( "Column culling: %s",
+            m_culler.isGpuDriven() ? "GPU (compute + indirect)" : "CPU" );
+        ImGui::RadioButton( "Off", &m_sim_mode, Simulation::OFF );
+        ImGui::SameLine();
+        ImGui::RadioButton( "Sandpile", &m_sim_mode, Simulation::SANDPILE );
+        ImGui::SameLine();
+        ImGui::RadioButton( "Erosion", &m_sim_mode, Simulation::EROSION );
+        ImGui::SameLine();
+        ImGui::RadioButton( "Gravity", &m_sim_mode, Simulation::GRAVITY );
+        ImGui::SliderFloat( "Ticks/s", &m_tick_rate, 1.0f, 240.0f );
+        ImGui::Text( "Simulation: %.1f ticks/s, %.0f cells/s",
+            m_ticks_per_sec, m_cells_per_sec );
+
+        // Offscreen export at the size below, from the current angle.
+        static int exportSize[2] = { 3840, 2160 };
+        static int turntableFrames = 360;
+        ImGui::InputInt( "Export width", &exportSize[0] );
+        ImGui::InputInt( "Export height", &exportSize[1] );
+        ImGui::InputInt( "Turntable frames", &turntableFrames );
+        // Keep the frame within what the exporter takes.
+        int maxPixels = int( Exporter::MAX_FRAME_PIXELS );
+        exportSize[0] = glm::clamp( exportSize[0], 1, 65536 );
+        exportSize[1] = glm::clamp( exportSize[1], 1,
+            std::min( 65536, maxPixels / exportSize[0] ) );
+        turntableFrames = glm::clamp( turntableFrames, 1, 100000 );
+
+        if( ImGui::Button( "Screenshot" ) ) {
+            if ( m_exporter.start( "screenshot", m_num_screenshots, 1,
+                    exportSize[0], exportSize[1], glm::radians( 45.0f ),
+                    1.0f, 1000.0f, m_rot_angle, 0.0f ) ) {
+                ++m_num_screenshots;
+                m_export_scale = m_scale;
+            }
+        }
+        ImGui::SameLine();
+        if( ImGui::Button( "Turntable" ) ) {
+            if ( m_exporter.start( "turntable", 0, turntableFrames,
+                    exportSize[0], exportSize[1], glm::radians( 45.0f ),
+                    1.0f, 1000.0f, m_rot_angle, 2.0f * M_PI / turntableFrames ) ) {
+                m_export_scale = m_scale;
+            }
+        }
+        if ( m_exporter.getFramesTotal() > 0 ) {
+            ImGui::Text( "Export: %d rendered, %d written, %d failed / %d",
+                m_exporter.getFramesRendered(), m_exporter.getFramesWritten(),
+                m_exporter.getFramesFailed(), m_exporter.getFramesTotal() );
+            ImGui::Text( "Export readback waits: %u updates",
+                m_exporter.getSlotWaits() );
+        }
+
+        ImGui::Text( "Stream fence waits: %u / %u frames (%s)",
+            m_stream.getFenceWaits(), m_stream.getFrames(),
+            m_stream.isPersistent() ? "persistent" : "orphaning" );
 
     ImGui::End();
 
@@ -293,13 +452,31 @@ void A1::guiLogic()
  */
 void A1::draw()
 {
-    // Create a global transformation for the model (centre it).
-    vec3 y_axis(0.0f, 1.0f, 0.0f);
+    // Bring the culler's copy of the columns up to date.  While exporting
+    // the active column is drawn with the rest, since exports leave out
+    // the overlay.
+    bool exporting = m_exporter.isBusy();
+    m_culler.update( m_grid, colour, NUM_COLOUR,
+        exporting ? -1 : m_active_x, exporting ? -1 : m_active_z,
+        m_grid_dirty );
+    m_grid_dirty = false;
+
+    m_exporter.update( [this]( const mat4 &P, float angle ) {
+        renderScene( P, modelMatrix( angle, m_export_scale ), false );
+    } );
+
+    renderScene( proj, modelMatrix( m_rot_angle, m_scale ), true );
+}
 
-    mat4 W;
-    W = glm::rotate( W, m_rot_angle, y_axis );
-    W = glm::scale( W, vec3(m_scale) );
-    W = glm::translate( W, vec3( -float(DIM)/2.0f, 0, -float(DIM)/2.0f ) );
+//----------------------------------------------------------------------------------------
+/*
+ * Draws the grid and columns with projection P and model matrix W, and
+ * the active column's overlay if asked to.
+ */
+void A1::renderScene( const mat4 &P, const mat4 &W, bool overlay )
+{
+    // Cull the columns before our shader takes over.
+    m_culler.cull( P * view * W );
 
     m_shader.enable();
 
@@ -308,13 +485,15 @@ void A1::draw()
 
 
 
-        glUniformMatrix4fv( P_uni, 1, GL_FALSE, value_ptr( proj ) );
+        glUniformMatrix4fv( P_uni, 1, GL_FALSE, value_ptr( P ) );
         glUniformMatrix4fv( V_uni, 1, GL_FALSE, value_ptr( view ) );
         glUniformMatrix4fv( M_uni, 1, GL_FALSE, value_ptr( W ) );
 
-        // draw the grid
+        // draw the grid; its VAO has no per-instance arrays, so the
+        // offset and colour come from the current generic attributes
         glBindVertexArray( m_grid_vao );
-        glUniform3f( col_uni, 1, 1, 1 );
+        glVertexAttrib4f( offset_attr, 0, 0, 0, 1 );
+        glVertexAttrib3f( col_attr, 1, 1, 1 );
         glDrawArrays( GL_LINES, 0, (3+DIM)*4 );
 
         glBindVertexArray( 0 );
@@ -322,68 +501,45 @@ void A1::draw()
 
 
 
-        // draw cubes by repeatly drawing a unit cube
-        // transformed into desired position
-        glBindVertexArray( m_cube_vao );
-        for ( int x = 0; x < DIM; x++ ) {
-            for ( int z = 0; z < DIM; z++ ) {
+        // draw the visible columns
+        glBindVertexArray( m_column_vao );
+        m_culler.draw();
 
-                if ( x == m_active_x && z == m_active_z ) {
-                    continue;
-                }
-
-                int h = m_grid.getHeight( x, z );
-                int c = m_grid.getColour( x, z );
-                for ( int y = 0; y < h; y++ ) {
+        if ( overlay ) {
+            // write the active column's solid blocks followed by its outline
+            // skeleton (with an EXTRA cube on top) into the stream buffer,
+            // never more than one region holds
+            BlockInstance *inst = (BlockInstance *)m_stream.map();
+            size_t ct = buildColumnBlocks( m_grid, colour, m_active_x, m_active_z,
+                inst, m_stream.getRegionSize() / sizeof(BlockInstance) );
+            GLintptr base = m_stream.unmap();
 
-                    mat4 Trans = W;
-                    // honestly, maybe I should undo the global translation,
-                    // perform this translation, then redo the global translation
-                    // but since translations are communative, I'll just do this
-                    Trans = glm::translate( Trans, vec3( x, y, z ) );
-                    glUniformMatrix4fv( M_uni, 1, GL_FALSE, value_ptr( Trans ) );
+            int active_h = int( ( ct - 1 ) / 2 );
+            size_t active_first = 0;
+            size_t outline_first = active_h;
 
-                    float r = colour[ 3*c ];
-                    float g = colour[ 3*c + 1 ];
-                    float b = colour[ 3*c + 2 ];
-                    glUniform3f( col_uni, r, g, b );
-                    glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            glBindVertexArray( m_cube_vao );
 
-                }
+            {
+                // outline active column in black, level by level so each
+                // outline is drawn over the solid block below it
+                glDisable( GL_DEPTH_TEST );
+                for ( int y = 0; y < active_h+1; y++ ) {
 
-            }
-        }
+                    if ( y < active_h ) {
+                        bindInstances( base + (active_first + y)*sizeof(BlockInstance) );
+                        glDrawElementsInstanced( GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, 1 );
+                    }
 
-        {
-            // outline active column in green, add skeleton of EXTRA cube on top
-            // this draw an EXTRA SKELETON CUBE
-            glDisable( GL_DEPTH_TEST );
-            int h = m_grid.getHeight( m_active_x, m_active_z );
-            int c = m_grid.getColour( m_active_x, m_active_z );
-            float r = colour[ 3*c ];
-            float g = colour[ 3*c + 1 ];
-            float b = colour[ 3*c + 2 ];
-            for ( int y = 0; y < h+1; y++ ) {
-
-                mat4 Trans = W;
-                // honestly, maybe I should undo the global translation,
-                // perform this translation, then redo the global translation
-                // but since translations are communative, I'll just do this
-                Trans = glm::translate( Trans, vec3( m_active_x, y, m_active_z ) );
-                glUniformMatrix4fv( M_uni, 1, GL_FALSE, value_ptr( Trans ) );
-
-
-                if ( y < h ) {
-                    glUniform3f( col_uni, r, g, b );
-                    glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+                    bindInstances( base + (outline_first + y)*sizeof(BlockInstance) );
+                    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+                    glDrawElementsInstanced( GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, 1 );
+                    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
                 }
-
-                glUniform3f( col_uni, 0, 0, 0 );
-                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+                glEnable( GL_DEPTH_TEST );
             }
-            glEnable( GL_DEPTH_TEST );
+
+            m_stream.fence();
         }
 
 
@@ -404,7 +560,11 @@ void A1::draw()
  * Called once, after program is signaled to terminate.
  */
 void A1::cleanup()
-{}
+{
+    m_exporter.destroy();
+    m_culler.destroy();
+    m_stream.destroy();
+}
 
 //----------------------------------------------------------------------------------------
 /*
@@ -526,6 +686,7 @@ bool A1::keyInputEvent(int key, int action, int mods) {
             int h = m_grid.getHeight( m_active_x, m_active_z );
             h = glm::clamp( h-1, 0, (int)MAX_HEIGHT );
             m_grid.setHeight( m_active_x, m_active_z, h );
+            m_grid_dirty = true;
             eventHandled = true;
 
         } else if ( key == GLFW_KEY_SPACE ) {
@@ -538,6 +699,7 @@ bool A1::keyInputEvent(int key, int action, int mods) {
             h = glm::clamp( h+1, 0, (int)MAX_HEIGHT );
             m_grid.setHeight( m_active_x, m_active_z, h );
             m_grid.setColour( m_active_x, m_active_z, c );
+            m_grid_dirty = true;
             eventHandled = true;
 
         } else if ( key == GLFW_KEY_UP ) {
@@ -548,6 +710,7 @@ bool A1::keyInputEvent(int key, int action, int mods) {
                 int c = m_grid.getColour( m_active_x, m_active_z );
                 m_grid.setHeight( m_active_x, new_z, h);
                 m_grid.setColour( m_active_x, new_z, c);
+                m_grid_dirty = true;
             }
 
             m_active_z = new_z;
@@ -561,6 +724,7 @@ bool A1::keyInputEvent(int key, int action, int mods) {
                 int c = m_grid.getColour( m_active_x, m_active_z );
                 m_grid.setHeight( m_active_x, new_z, h);
                 m_grid.setColour( m_active_x, new_z, c);
+                m_grid_dirty = true;
             }
 
             m_active_z = new_z;
@@ -574,6 +738,7 @@ bool A1::keyInputEvent(int key, int action, int mods) {
                 int c = m_grid.getColour( m_active_x, m_active_z );
                 m_grid.setHeight( new_x, m_active_z, h);
                 m_grid.setColour( new_x, m_active_z, c);
+                m_grid_dirty = true;
             }
 
             m_active_x = new_x;
@@ -587,6 +752,7 @@ bool A1::keyInputEvent(int key, int action, int mods) {
                 int c = m_grid.getColour( m_active_x, m_active_z );
                 m_grid.setHeight( new_x, m_active_z, h);
                 m_grid.setColour( new_x, m_active_z, c);
+                m_grid_dirty = true;
             }
 
             m_active_x = new_x;
@@ -600,6 +766,35 @@ bool A1::keyInputEvent(int key, int action, int mods) {
 
 // helper functions
 
+/*
+ * Global transformation for the model: centred, scaled and turned by
+ * angle radians about the y axis.
+ */
+mat4 A1::modelMatrix( float angle, float scale ) const {
+    vec3 y_axis(0.0f, 1.0f, 0.0f);
+
+    mat4 W;
+    W = glm::rotate( W, angle, y_axis );
+    W = glm::scale( W, vec3(scale) );
+    W = glm::translate( W, vec3( -float(DIM)/2.0f, 0, -float(DIM)/2.0f ) );
+    return W;
+}
+
+/*
+ * Point the cube VAO's per-instance attributes at the block instances
+ * starting at byte offset base in the stream buffer.
+ */
+void A1::bindInstances( GLintptr base ) {
+    glBindBuffer( GL_ARRAY_BUFFER, m_stream.getBuffer() );
+    glVertexAttribPointer( offset_attr, 4, GL_FLOAT, GL_FALSE,
+        sizeof(BlockInstance),
+        (const GLvoid *)( base + offsetof(BlockInstance, offset) ) );
+    glVertexAttribPointer( col_attr, 3, GL_FLOAT, GL_FALSE,
+        sizeof(BlockInstance),
+        (const GLvoid *)( base + offsetof(BlockInstance, colour) ) );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
 /*
  * Reset View, move active block back to (0,0)
  */
@@ -631,4 +826,5 @@ void A1::reset() {
             m_grid.setColour( x, z, 0 );
         }
     }
+    m_grid_dirty = true;
 }
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <chrono>
+#include <memory>
+#include <string>
+
 #include <glm/glm.hpp>
 
 #include "cs488-framework/CS488Window.hpp"
@@ -7,12 +11,22 @@
 #include "cs488-framework/ShaderProgram.hpp"
 
 #include "grid.hpp"
+#include "column_culler.hpp"
+#include "exporter.hpp"
+#include "simulation.hpp"
+#include "stream_buffer.hpp"
 
 class A1 : public CS488Window {
 public:
-    A1();
+    // Starts with the given grid's contents if there is one.
+    A1( std::unique_ptr<Grid> grid = nullptr );
     virtual ~A1();
 
+    // Loads a heightmap (and optional colour-class image) into a grid the
+    // size A1 uses.  Returns null and sets error on failure.
+    static std::unique_ptr<Grid> importGrid( const std::string &heightmap,
+        const std::string &classes, std::string &error );
+
 protected:
     virtual void init() override;
     virtual void appLogic() override;
@@ -30,13 +44,17 @@ protected:
 private:
     void initGrid();
     void reset();
+    void bindInstances( GLintptr base );
+    glm::mat4 modelMatrix( float angle, float scale ) const;
+    void renderScene( const glm::mat4 &P, const glm::mat4 &W, bool overlay );
 
     // Fields related to the shader and uniforms.
     ShaderProgram m_shader;
     GLint P_uni; // Uniform location for Projection matrix.
     GLint V_uni; // Uniform location for View matrix.
     GLint M_uni; // Uniform location for Model matrix.
-    GLint col_uni;   // Uniform location for cube colour.
+    GLint offset_attr; // Attribute location for per-block offset.
+    GLint col_attr;    // Attribute location for per-block colour.
 
     // Fields related to grid geometry.
     GLuint m_grid_vao; // Vertex Array Object
@@ -47,6 +65,20 @@ private:
     GLuint m_cube_vbo; // Vertex Buffer Object
     GLuint m_cube_ebo; // Vertex Element Buffer Object
 
+    // Columns are drawn as the cube scaled to their height, one instance
+    // per visible column.
+    GLuint m_column_vao; // Vertex Array Object
+    ColumnCuller m_culler;
+
+    // Per-frame block instances (placement and colour) for the active
+    // column and its outline.
+    StreamBuffer m_stream;
+
+    // Offscreen screenshot and turntable export.
+    Exporter m_exporter;
+    int m_num_screenshots;
+    float m_export_scale; // m_scale when the export started
+
     // Matrices controlling the camera and projection.
     glm::mat4 proj;
     glm::mat4 view;
@@ -65,9 +97,24 @@ private:
 
     // grid control
     Grid m_grid;
+    bool m_grid_dirty; // grid modified since the culler last saw it
     int m_active_x;
     int m_active_z;
 
+    // cellular simulation, stepped at m_tick_rate independent of frame rate
+    Simulation m_sim;
+    int m_sim_mode;
+    float m_tick_rate;
+    double m_tick_accum;
+    std::chrono::steady_clock::time_point m_last_logic;
+
+    // simulation throughput, averaged over about a second
+    std::chrono::steady_clock::time_point m_stat_start;
+    size_t m_stat_ticks;
+    size_t m_stat_cells;
+    float m_ticks_per_sec;
+    float m_cells_per_sec;
+
 
     float *colour;
     int current_col;
@@ -0,0 +1,78 @@
+#version 430
+
+// One invocation per grid column: frustum cull the column's box and
+// append a BlockInstance for it to the instance buffer, bumping the
+// instance count of the indirect draw command.
+
+layout( local_size_x = 64 ) in;
+
+// x = height, y = colour index
+layout( std430, binding = 0 ) readonly buffer Columns {
+	ivec2 columns[];
+};
+
+// Pairs of (offset, colour), see BlockInstance.
+layout( std430, binding = 1 ) writeonly buffer Instances {
+	vec4 instances[];
+};
+
+layout( std430, binding = 2 ) buffer Command {
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+uniform mat4 PVM;
+uniform int dim;
+uniform ivec2 active_column;
+uniform vec3 palette[8];
+
+bool outside( vec3 lo, vec3 hi ) {
+	vec4 c[8];
+	for ( int i = 0; i < 8; ++i ) {
+		vec3 p = vec3( (i & 1) != 0 ? hi.x : lo.x,
+			(i & 2) != 0 ? hi.y : lo.y,
+			(i & 4) != 0 ? hi.z : lo.z );
+		c[i] = PVM * vec4( p, 1.0 );
+	}
+
+	// Culled if every corner lies beyond the same clip plane.
+	for ( int axis = 0; axis < 3; ++axis ) {
+		bool all_neg = true;
+		bool all_pos = true;
+		for ( int i = 0; i < 8; ++i ) {
+			all_neg = all_neg && c[i][axis] < -c[i].w;
+			all_pos = all_pos && c[i][axis] > c[i].w;
+		}
+		if ( all_neg || all_pos ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void main() {
+	uint idx = gl_GlobalInvocationID.x;
+	if ( idx >= uint( dim * dim ) ) {
+		return;
+	}
+
+	int x = int( idx ) % dim;
+	int z = int( idx ) / dim;
+	int h = columns[idx].x;
+
+	if ( h <= 0 || ( x == active_column.x && z == active_column.y ) ) {
+		return;
+	}
+
+	vec3 lo = vec3( x, 0, z );
+	if ( outside( lo, lo + vec3( 1, h, 1 ) ) ) {
+		return;
+	}
+
+	uint slot = atomicAdd( instanceCount, 1u );
+	instances[ 2u*slot ] = vec4( lo, float( h ) );
+	instances[ 2u*slot + 1u ] = vec4( palette[ columns[idx].y ], 1.0 );
+}
@@ -1,9 +1,9 @@
 #version 330
 
-uniform vec3 colour;
+in vec3 vcolour;
 
 out vec4 fragColor;
 
 void main() {
-	fragColor = vec4( colour, 1 );
+	fragColor = vec4( vcolour, 1 );
 }
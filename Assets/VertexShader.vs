@@ -5,6 +5,14 @@ uniform mat4 V;
 uniform mat4 M;
 in vec3 position;
 
+// Per-instance block placement: xyz translation, w scales the unit cube's height.
+in vec4 offset;
+in vec3 colour;
+
+out vec3 vcolour;
+
 void main() {
-	gl_Position = P * V * M * vec4(position, 1.0);
+	vec3 pos = vec3( position.x, position.y * offset.w, position.z ) + offset.xyz;
+	vcolour = colour;
+	gl_Position = P * V * M * vec4(pos, 1.0);
 }
@@ -1,7 +1,46 @@
 #include "A1.hpp"
 
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+
+static const char *USAGE = "Usage: A1 [--import heightmap [--classes class-image]]\n";
+
 int main( int argc, char **argv ) 
 {
-	CS488Window::launch( argc, argv, new A1(), 1024, 768, "Assignment 1" );
+	std::string heightmap;
+	std::string classes;
+	for ( int i = 1; i < argc; ++i ) {
+		bool import = strcmp( argv[i], "--import" ) == 0;
+		bool cls = strcmp( argv[i], "--classes" ) == 0;
+		if ( ( import || cls ) && i + 1 >= argc ) {
+			fputs( USAGE, stderr );
+			return 1;
+		}
+		if ( import ) {
+			heightmap = argv[ ++i ];
+		} else if ( cls ) {
+			classes = argv[ ++i ];
+		}
+	}
+	if ( !classes.empty() && heightmap.empty() ) {
+		fputs( USAGE, stderr );
+		return 1;
+	}
+
+	// Import before opening a window, so a bad file is a failed run.
+	std::unique_ptr<Grid> grid;
+	if ( !heightmap.empty() ) {
+		std::string error;
+		grid = A1::importGrid( heightmap, classes, error );
+		if ( !grid ) {
+			fprintf( stderr, "Import failed: %s\n", error.c_str() );
+			return 1;
+		}
+	}
+
+	CS488Window::launch( argc, argv, new A1( std::move( grid ) ), 1024, 768, "Assignment 1" );
 	return 0;
 }
@@ -0,0 +1,368 @@
+/*
+ * Micro-benchmarks for the Grid and the CPU-side geometry built from it,
+ * independent of GL and GLFW.  Each benchmark is timed in batches of
+ * calls long enough to swamp the clock; after a few warmup batches the
+ * median, mean and coefficient of variation (CV) of the per-op time are
+ * taken over a number of repetitions.  Results with a CV above 5% are
+ * flagged, and should be rerun on a quieter machine before comparing.
+ *
+ *   grid-bench [--reps N] [--warmup N] [--min-ms N] [--max-dim N] [filter]
+ *
+ * Only benchmarks whose name contains filter are run.  Grids go from 16
+ * to max-dim (default 1024) cells a side in steps of 4x.  Run it from a
+ * release build.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../grid.hpp"
+#include "../mesh.hpp"
+
+using namespace std;
+
+static const int MAX_HEIGHT = 20;
+static const int NUM_COLOUR = 8;
+static const double UNSTABLE_CV = 0.05;
+
+static int g_reps = 11;
+static int g_warmup = 3;
+static double g_min_ns = 10e6;
+static size_t g_max_dim = 1024;
+static string g_filter;
+
+// Results are folded into here so the work can't be optimised away.
+static volatile long g_sink;
+
+/*
+ * Grid's storage scheme (separate height and colour arrays, row-major)
+ * over any cell type, so narrower cells can be compared without touching
+ * Grid.  Its accessors are inline where Grid's are not; the int32 rows
+ * against the Grid rows show what the call costs.
+ */
+template<typename T>
+class BasicGrid
+{
+public:
+	BasicGrid( size_t dim )
+		: m_dim( dim )
+		, m_heights( dim * dim )
+		, m_cols( dim * dim )
+	{}
+
+	void reset()
+	{
+		fill( m_heights.begin(), m_heights.end(), T( 0 ) );
+		fill( m_cols.begin(), m_cols.end(), T( 0 ) );
+	}
+
+	size_t getDim() const { return m_dim; }
+
+	int getHeight( int x, int y ) const { return m_heights[ y * m_dim + x ]; }
+	int getColour( int x, int y ) const { return m_cols[ y * m_dim + x ]; }
+	void setHeight( int x, int y, int h ) { m_heights[ y * m_dim + x ] = T( h ); }
+	void setColour( int x, int y, int c ) { m_cols[ y * m_dim + x ] = T( c ); }
+
+	const T *getHeights() const { return m_heights.data(); }
+
+private:
+	size_t m_dim;
+	vector<T> m_heights;
+	vector<T> m_cols;
+};
+
+static inline uint32_t xorshift( uint32_t &s )
+{
+	s ^= s << 13;
+	s ^= s >> 17;
+	s ^= s << 5;
+	return s;
+}
+
+static bool selected( const string &name )
+{
+	return g_filter.empty() || name.find( g_filter ) != string::npos;
+}
+
+/*
+ * Times fn(), which performs opsPerCall operations each touching
+ * bytesPerOp bytes, and prints one result line.
+ */
+template<typename Fn>
+static void run( const string &name, size_t dim, const char *cell,
+	size_t opsPerCall, double bytesPerOp, Fn fn )
+{
+	if ( !selected( name ) ) {
+		return;
+	}
+
+	typedef chrono::steady_clock clock;
+
+	// Double the batch until it takes long enough to time reliably.
+	size_t calls = 1;
+	for ( ;; ) {
+		clock::time_point t0 = clock::now();
+		for ( size_t i = 0; i < calls; ++i ) {
+			fn();
+		}
+		double ns = chrono::duration<double, nano>( clock::now() - t0 ).count();
+		if ( ns >= g_min_ns || calls >= ( size_t( 1 ) << 30 ) ) {
+			break;
+		}
+		calls *= 2;
+	}
+
+	vector<double> samples;
+	for ( int rep = 0; rep < g_warmup + g_reps; ++rep ) {
+		clock::time_point t0 = clock::now();
+		for ( size_t i = 0; i < calls; ++i ) {
+			fn();
+		}
+		double ns = chrono::duration<double, nano>( clock::now() - t0 ).count();
+		if ( rep >= g_warmup ) {
+			samples.push_back( ns / double( calls * opsPerCall ) );
+		}
+	}
+
+	double mean = 0;
+	for ( double s : samples ) {
+		mean += s;
+	}
+	mean /= samples.size();
+
+	double var = 0;
+	for ( double s : samples ) {
+		var += ( s - mean ) * ( s - mean );
+	}
+	double cv = samples.size() > 1 ? sqrt( var / ( samples.size() - 1 ) ) / mean : 0;
+
+	sort( samples.begin(), samples.end() );
+	size_t n = samples.size();
+	double median = n % 2 ? samples[ n/2 ] : 0.5 * ( samples[ n/2 - 1 ] + samples[ n/2 ] );
+
+	printf( "%-22s %6zu  %-6s %10.3f %10.3f %8.1f %7.2f%%%s\n",
+		name.c_str(), dim, cell, median, mean, bytesPerOp, cv * 100,
+		cv > UNSTABLE_CV ? " *" : "" );
+	fflush( stdout );
+}
+
+// Random heights and colours, roughly a quarter of the columns empty.
+template<typename G>
+static void fillRandom( G &grid, uint32_t seed )
+{
+	int dim = int( grid.getDim() );
+	for ( int y = 0; y < dim; ++y ) {
+		for ( int x = 0; x < dim; ++x ) {
+			uint32_t r = xorshift( seed );
+			int h = int( r % ( 4 * MAX_HEIGHT / 3 ) ) - MAX_HEIGHT / 3;
+			grid.setHeight( x, y, max( h, 0 ) );
+			grid.setColour( x, y, int( ( r >> 16 ) % NUM_COLOUR ) );
+		}
+	}
+}
+
+/*
+ * Grid access patterns.  Random cells come from a list made up front (x
+ * in the low 16 bits, y in the high), so the loops measure the grid, not
+ * the generator; the list is read in order and costs little.
+ */
+template<typename G, typename T>
+static void benchAccess( size_t dim, const char *cell )
+{
+	G grid( dim );
+	fillRandom( grid, 1 );
+
+	int d = int( dim );
+	size_t cells = dim * dim;
+	size_t randomOps = min( cells, size_t( 1 ) << 16 );
+
+	vector<uint32_t> randomCells( randomOps );
+	uint32_t seed = 0x9e3779b9u;
+	for ( uint32_t &rc : randomCells ) {
+		uint32_t x = xorshift( seed ) % dim;
+		uint32_t y = xorshift( seed ) % dim;
+		rc = x | ( y << 16 );
+	}
+
+	run( "get/sequential", dim, cell, cells, sizeof(T), [&]() {
+		long sum = 0;
+		for ( int y = 0; y < d; ++y ) {
+			for ( int x = 0; x < d; ++x ) {
+				sum += grid.getHeight( x, y );
+			}
+		}
+		g_sink = sum;
+	} );
+
+	run( "get/strided", dim, cell, cells, sizeof(T), [&]() {
+		long sum = 0;
+		for ( int x = 0; x < d; ++x ) {
+			for ( int y = 0; y < d; ++y ) {
+				sum += grid.getHeight( x, y );
+			}
+		}
+		g_sink = sum;
+	} );
+
+	run( "get/random", dim, cell, randomOps, sizeof(T), [&]() {
+		long sum = 0;
+		for ( uint32_t rc : randomCells ) {
+			sum += grid.getHeight( int( rc & 0xffff ), int( rc >> 16 ) );
+		}
+		g_sink = sum;
+	} );
+
+	run( "set/sequential", dim, cell, cells, sizeof(T), [&]() {
+		for ( int y = 0; y < d; ++y ) {
+			for ( int x = 0; x < d; ++x ) {
+				grid.setHeight( x, y, ( x + y ) & 15 );
+			}
+		}
+		g_sink = grid.getHeight( 0, 0 );
+	} );
+
+	run( "set/random", dim, cell, randomOps, sizeof(T), [&]() {
+		for ( uint32_t rc : randomCells ) {
+			grid.setHeight( int( rc & 0xffff ), int( rc >> 16 ), int( rc & 15 ) );
+		}
+		g_sink = grid.getHeight( 0, 0 );
+	} );
+
+	run( "reset", dim, cell, cells, 2 * sizeof(T), [&]() {
+		grid.reset();
+		g_sink = grid.getHeight( 0, 0 );
+	} );
+
+	// Whole rows straight from the backing store, as uploads read them.
+	run( "rows/stream", dim, cell, cells, sizeof(T), [&]() {
+		const T *heights = grid.getHeights();
+		long sum = 0;
+		for ( size_t y = 0; y < dim; ++y ) {
+			const T *row = heights + y * dim;
+			for ( size_t x = 0; x < dim; ++x ) {
+				sum += row[x];
+			}
+		}
+		g_sink = sum;
+	} );
+}
+
+/*
+ * The geometry A1 builds on the CPU for a whole grid: the floor lines
+ * from initGrid(), and the per-column instances (offset, height and
+ * colour for each drawn cube) the draw loop uses in place of per-block
+ * model matrices.
+ */
+static void benchGeometry( size_t dim )
+{
+	Grid grid( dim );
+	fillRandom( grid, 2 );
+
+	float palette[ NUM_COLOUR * 3 ];
+	for ( int i = 0; i < NUM_COLOUR * 3; ++i ) {
+		palette[i] = float( i ) / ( NUM_COLOUR * 3 );
+	}
+
+	vector<float> verts;
+	size_t lines = 2 * ( dim + 3 );
+	run( "mesh/grid-lines", dim, "float", lines, 6 * sizeof(float), [&]() {
+		buildGridLines( dim, verts );
+		g_sink = long( verts[0] );
+	} );
+
+	// Per column: its height and colour read, an instance written if drawn.
+	vector<BlockInstance> insts;
+	buildColumnInstances( grid, palette, -1, -1, insts );
+	size_t columns = dim * dim;
+	double instBytes = 2 * sizeof(int)
+		+ double( insts.size() * sizeof(BlockInstance) ) / columns;
+	run( "mesh/column-instances", dim, "int", columns, instBytes, [&]() {
+		buildColumnInstances( grid, palette, -1, -1, insts );
+		g_sink = long( insts.size() );
+	} );
+
+	vector<int> packed;
+	run( "mesh/pack-columns", dim, "int", columns, 4 * sizeof(int), [&]() {
+		packColumns( grid, packed );
+		g_sink = packed[0];
+	} );
+}
+
+/*
+ * The active column's overlay, one instance per block and outline, as
+ * the draw loop streams it every frame: a full column on the app's grid.
+ */
+static void benchOverlay()
+{
+	static const size_t DIM = 16;
+
+	Grid grid( DIM );
+	grid.setHeight( DIM/2, DIM/2, MAX_HEIGHT );
+
+	float palette[ NUM_COLOUR * 3 ] = {};
+	vector<BlockInstance> insts( 2 * MAX_HEIGHT + 1 );
+	run( "mesh/column-blocks", DIM, "int", insts.size(), sizeof(BlockInstance), [&]() {
+		g_sink = long( buildColumnBlocks( grid, palette, DIM/2, DIM/2,
+			insts.data(), insts.size() ) );
+	} );
+}
+
+static void usage( const char *prog )
+{
+	fprintf( stderr, "usage: %s [--reps N] [--warmup N] [--min-ms N] [--max-dim N] [filter]\n", prog );
+	exit( 1 );
+}
+
+int main( int argc, char **argv )
+{
+	for ( int i = 1; i < argc; ++i ) {
+		string arg = argv[i];
+		if ( arg[0] != '-' ) {
+			g_filter = arg;
+			continue;
+		}
+		if ( i + 1 >= argc ) {
+			usage( argv[0] );
+		}
+		double val = atof( argv[ ++i ] );
+		if ( arg == "--reps" && val >= 2 ) {
+			g_reps = int( val );
+		} else if ( arg == "--warmup" && val >= 0 ) {
+			g_warmup = int( val );
+		} else if ( arg == "--min-ms" && val > 0 ) {
+			g_min_ns = val * 1e6;
+		} else if ( arg == "--max-dim" && val >= 16 && val <= 65536 ) {
+			g_max_dim = size_t( val );
+		} else {
+			usage( argv[0] );
+		}
+	}
+
+	printf( "%d repetitions of >= %.0f ms after %d warmup; * marks CV > %.0f%%\n\n",
+		g_reps, g_min_ns / 1e6, g_warmup, UNSTABLE_CV * 100 );
+	printf( "%-22s %6s  %-6s %10s %10s %8s %8s\n",
+		"benchmark", "dim", "cell", "median ns", "mean ns", "B/op", "CV" );
+
+	for ( size_t dim = 16; dim <= g_max_dim; dim *= 4 ) {
+		benchAccess<Grid, int>( dim, "Grid" );
+		benchAccess<BasicGrid<int32_t>, int32_t>( dim, "int32" );
+		benchAccess<BasicGrid<int16_t>, int16_t>( dim, "int16" );
+		benchAccess<BasicGrid<int8_t>, int8_t>( dim, "int8" );
+	}
+
+	// Up to 32 bytes of instances per column, so a larger --max-dim
+	// still stops these at 1024 (32 MB).
+	for ( size_t dim = 16; dim <= min( g_max_dim, size_t( 1024 ) ); dim *= 4 ) {
+		benchGeometry( dim );
+	}
+	benchOverlay();
+
+	return 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+ * Per-instance data for one cube draw, laid out as two vec4s so the same
+ * records can be written by the CPU and by the culling compute shader.
+ */
+struct BlockInstance
+{
+	float offset[4]; // xyz translation, w height scale
+	float colour[4];
+};
+
+inline void setInstance( BlockInstance &inst, float x, float y, float z,
+	float h, float r, float g, float b )
+{
+	inst.offset[0] = x;
+	inst.offset[1] = y;
+	inst.offset[2] = z;
+	inst.offset[3] = h;
+	inst.colour[0] = r;
+	inst.colour[1] = g;
+	inst.colour[2] = b;
+	inst.colour[3] = 1.0f;
+}
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "column_culler.hpp"
+#include "mesh.hpp"
+#include "cs488-framework/GlErrorCheck.hpp"
+
+// Must match local_size_x in CullColumns.cs.
+static const GLuint CULL_GROUP_SIZE = 64;
+
+// Number of indices in the unit cube's element buffer.
+static const GLuint CUBE_INDICES = 36;
+
+const size_t ColumnCuller::MAX_COLOURS;
+
+ColumnCuller::ColumnCuller()
+	: m_dim( 0 )
+	, m_active_x( -1 )
+	, m_active_z( -1 )
+	, m_instance_buf( 0 )
+	, m_num_instances( 0 )
+	, m_gpu( false )
+	, m_column_buf( 0 )
+	, m_indirect_buf( 0 )
+	, m_program( 0 )
+	, m_pvm_uni( -1 )
+	, m_dim_uni( -1 )
+	, m_active_uni( -1 )
+	, m_palette_uni( -1 )
+{
+	std::fill( m_palette, m_palette + MAX_COLOURS * 3, -1.0f );
+}
+
+void ColumnCuller::init( size_t dim, const std::string &computePath )
+{
+	m_dim = dim;
+
+	glGenBuffers( 1, &m_instance_buf );
+	glBindBuffer( GL_ARRAY_BUFFER, m_instance_buf );
+	glBufferData( GL_ARRAY_BUFFER, dim * dim * sizeof(BlockInstance),
+		nullptr, GL_DYNAMIC_DRAW );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	m_gpu = initCompute( computePath );
+	CHECK_GL_ERRORS;
+}
+
+/*
+ * Compiles the culling compute shader and creates its buffers.  Returns
+ * false, leaving the CPU path in charge, if the context can't run it.
+ */
+bool ColumnCuller::initCompute( const std::string &computePath )
+{
+#ifdef GL_COMPUTE_SHADER
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv( GL_MAJOR_VERSION, &major );
+	glGetIntegerv( GL_MINOR_VERSION, &minor );
+	if ( major < 4 || ( major == 4 && minor < 3 ) ) {
+		return false;
+	}
+
+	std::ifstream in( computePath.c_str() );
+	if ( !in ) {
+		std::cerr << "Unable to open " << computePath << std::endl;
+		return false;
+	}
+	std::stringstream src;
+	src << in.rdbuf();
+	std::string text = src.str();
+	const char *text_ptr = text.c_str();
+
+	GLuint shader = glCreateShader( GL_COMPUTE_SHADER );
+	glShaderSource( shader, 1, &text_ptr, nullptr );
+	glCompileShader( shader );
+
+	GLint ok = GL_FALSE;
+	glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+	if ( !ok ) {
+		char log[ 1024 ];
+		glGetShaderInfoLog( shader, sizeof(log), nullptr, log );
+		std::cerr << computePath << ": " << log << std::endl;
+		glDeleteShader( shader );
+		return false;
+	}
+
+	m_program = glCreateProgram();
+	glAttachShader( m_program, shader );
+	glLinkProgram( m_program );
+	glDeleteShader( shader );
+
+	glGetProgramiv( m_program, GL_LINK_STATUS, &ok );
+	if ( !ok ) {
+		char log[ 1024 ];
+		glGetProgramInfoLog( m_program, sizeof(log), nullptr, log );
+		std::cerr << computePath << ": " << log << std::endl;
+		glDeleteProgram( m_program );
+		m_program = 0;
+		return false;
+	}
+
+	m_pvm_uni = glGetUniformLocation( m_program, "PVM" );
+	m_dim_uni = glGetUniformLocation( m_program, "dim" );
+	m_active_uni = glGetUniformLocation( m_program, "active_column" );
+	m_palette_uni = glGetUniformLocation( m_program, "palette" );
+
+	glGenBuffers( 1, &m_column_buf );
+	glBindBuffer( GL_SHADER_STORAGE_BUFFER, m_column_buf );
+	glBufferData( GL_SHADER_STORAGE_BUFFER, m_dim * m_dim * 2 * sizeof(GLint),
+		nullptr, GL_DYNAMIC_DRAW );
+	glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+
+	glGenBuffers( 1, &m_indirect_buf );
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, m_indirect_buf );
+	glBufferData( GL_DRAW_INDIRECT_BUFFER, 5 * sizeof(GLuint),
+		nullptr, GL_DYNAMIC_DRAW );
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void ColumnCuller::destroy()
+{
+	if ( m_program ) {
+		glDeleteProgram( m_program );
+		m_program = 0;
+	}
+
+	GLuint bufs[] = { m_instance_buf, m_column_buf, m_indirect_buf };
+	for ( GLuint buf : bufs ) {
+		if ( buf ) {
+			glDeleteBuffers( 1, &buf );
+		}
+	}
+	m_instance_buf = 0;
+	m_column_buf = 0;
+	m_indirect_buf = 0;
+}
+
+bool ColumnCuller::isGpuDriven() const
+{
+	return m_gpu;
+}
+
+GLuint ColumnCuller::getInstanceBuffer() const
+{
+	return m_instance_buf;
+}
+
+/*
+ * Brings the GPU's copy of the columns up to date.  gridChanged must be
+ * set whenever a height or colour in the grid was modified since the
+ * last call.
+ */
+void ColumnCuller::update( const Grid &grid, const float *palette,
+	size_t numColours, int active_x, int active_z, bool gridChanged )
+{
+	size_t pal_sz = std::min( numColours, MAX_COLOURS ) * 3;
+	bool pal_changed = memcmp( m_palette, palette, pal_sz * sizeof(float) ) != 0;
+	bool active_changed = active_x != m_active_x || active_z != m_active_z;
+
+	std::copy( palette, palette + pal_sz, m_palette );
+	m_active_x = active_x;
+	m_active_z = active_z;
+
+#ifdef GL_COMPUTE_SHADER
+	if ( m_gpu ) {
+		// Palette and active column are uniforms, so only the grid matters.
+		if ( gridChanged ) {
+			packColumns( grid, m_packed );
+			glBindBuffer( GL_SHADER_STORAGE_BUFFER, m_column_buf );
+			glBufferSubData( GL_SHADER_STORAGE_BUFFER, 0,
+				m_packed.size() * sizeof(int), m_packed.data() );
+			glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+		}
+		return;
+	}
+#endif
+
+	if ( !gridChanged && !pal_changed && !active_changed ) {
+		return;
+	}
+
+	buildColumnInstances( grid, m_palette, active_x, active_z, m_instances );
+
+	m_num_instances = m_instances.size();
+	glBindBuffer( GL_ARRAY_BUFFER, m_instance_buf );
+	glBufferSubData( GL_ARRAY_BUFFER, 0,
+		m_instances.size() * sizeof(BlockInstance), m_instances.data() );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+/*
+ * Runs the culling pass against pvm (projection * view * model).  Call
+ * outside of any other program, before the draw() that consumes it.
+ */
+void ColumnCuller::cull( const glm::mat4 &pvm )
+{
+#ifdef GL_COMPUTE_SHADER
+	if ( !m_gpu ) {
+		return;
+	}
+
+	// count, instanceCount, firstIndex, baseVertex, baseInstance
+	GLuint cmd[] = { CUBE_INDICES, 0, 0, 0, 0 };
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, m_indirect_buf );
+	glBufferSubData( GL_DRAW_INDIRECT_BUFFER, 0, sizeof(cmd), cmd );
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+
+	glUseProgram( m_program );
+	glUniformMatrix4fv( m_pvm_uni, 1, GL_FALSE, glm::value_ptr( pvm ) );
+	glUniform1i( m_dim_uni, GLint( m_dim ) );
+	glUniform2i( m_active_uni, m_active_x, m_active_z );
+	glUniform3fv( m_palette_uni, MAX_COLOURS, m_palette );
+
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, m_column_buf );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, m_instance_buf );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 2, m_indirect_buf );
+
+	GLuint groups = GLuint( ( m_dim * m_dim + CULL_GROUP_SIZE - 1 ) / CULL_GROUP_SIZE );
+	glDispatchCompute( groups, 1, 1 );
+	glMemoryBarrier( GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT );
+
+	for ( GLuint i = 0; i < 3; ++i ) {
+		glBindBufferBase( GL_SHADER_STORAGE_BUFFER, i, 0 );
+	}
+	glUseProgram( 0 );
+	CHECK_GL_ERRORS;
+#endif
+}
+
+void ColumnCuller::draw()
+{
+#ifdef GL_COMPUTE_SHADER
+	if ( m_gpu ) {
+		glBindBuffer( GL_DRAW_INDIRECT_BUFFER, m_indirect_buf );
+		glDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT, nullptr );
+		glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+		return;
+	}
+#endif
+
+	glDrawElementsInstanced( GL_TRIANGLES, CUBE_INDICES, GL_UNSIGNED_INT,
+		nullptr, GLsizei( m_num_instances ) );
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cs488-framework/OpenGLImport.hpp"
+
+#include "block_instance.hpp"
+#include "grid.hpp"
+
+/*
+ * Decides which grid columns get drawn, one BlockInstance per column
+ * (a unit cube scaled to the column's height).
+ *
+ * On GL 4.3+ the column heights and colours live in a GPU buffer and a
+ * compute pass frustum culls them, appending visible columns to the
+ * instance buffer and counting them into a GL_DRAW_INDIRECT_BUFFER
+ * command, so the CPU cost per frame doesn't depend on the grid size.
+ *
+ * Otherwise the instance buffer is rebuilt on the CPU, but only when the
+ * grid, palette or active column changed, and drawn with an instance
+ * count; culling is then left to the rasterizer.
+ */
+class ColumnCuller
+{
+public:
+	static const size_t MAX_COLOURS = 8;
+
+	ColumnCuller();
+
+	void init( size_t dim, const std::string &computePath );
+	void destroy();
+
+	bool isGpuDriven() const;
+	GLuint getInstanceBuffer() const;
+
+	void update( const Grid &grid, const float *palette, size_t numColours,
+		int active_x, int active_z, bool gridChanged );
+
+	void cull( const glm::mat4 &pvm );
+
+	// Draws the cube VAO (which must be bound) once per visible column.
+	void draw();
+
+private:
+	bool initCompute( const std::string &computePath );
+
+	size_t m_dim;
+	int m_active_x;
+	int m_active_z;
+	float m_palette[ MAX_COLOURS * 3 ];
+
+	GLuint m_instance_buf;
+
+	// CPU path
+	std::vector<BlockInstance> m_instances;
+	size_t m_num_instances;
+
+	// GPU path
+	std::vector<int> m_packed;
+	bool m_gpu;
+	GLuint m_column_buf;
+	GLuint m_indirect_buf;
+	GLuint m_program;
+	GLint m_pvm_uni;
+	GLint m_dim_uni;
+	GLint m_active_uni;
+	GLint m_palette_uni;
+};
@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "exporter.hpp"
+#include "png_writer.hpp"
+#include "cs488-framework/GlErrorCheck.hpp"
+
+// Largest tile we ask for, even if the driver allows more.
+static const size_t MAX_TILE = 2048;
+
+// Frames in flight in the readback ring.
+static const size_t RING_FRAMES = 2;
+
+// Frames being assembled or encoded may hold this much memory at once
+// (always at least one frame of MAX_FRAME_PIXELS).
+static const size_t MAX_BUFFERED_BYTES = size_t( 256 ) << 20;
+
+const size_t Exporter::MAX_FRAME_PIXELS;
+
+Exporter::Exporter()
+	: m_max_tile( MAX_TILE )
+	, m_first( 0 )
+	, m_count( 0 )
+	, m_width( 0 )
+	, m_height( 0 )
+	, m_fovy( 0 )
+	, m_near( 0 )
+	, m_far( 0 )
+	, m_angle0( 0 )
+	, m_angle_step( 0 )
+	, m_next_frame( 0 )
+	, m_next_x( 0 )
+	, m_next_y( 0 )
+	, m_fbo( 0 )
+	, m_colour_rb( 0 )
+	, m_depth_rb( 0 )
+	, m_tile_w( 0 )
+	, m_tile_h( 0 )
+	, m_tiles_per_frame( 0 )
+	, m_rendered( 0 )
+	, m_slot_waits( 0 )
+	, m_encoding( 0 )
+	, m_written( 0 )
+	, m_failed( 0 )
+{}
+
+void Exporter::init()
+{
+	GLint rb_max = 0;
+	GLint vp_max[2] = { 0, 0 };
+	glGetIntegerv( GL_MAX_RENDERBUFFER_SIZE, &rb_max );
+	glGetIntegerv( GL_MAX_VIEWPORT_DIMS, vp_max );
+
+	m_max_tile = MAX_TILE;
+	m_max_tile = std::min( m_max_tile, size_t( rb_max ) );
+	m_max_tile = std::min( m_max_tile, size_t( vp_max[0] ) );
+	m_max_tile = std::min( m_max_tile, size_t( vp_max[1] ) );
+	CHECK_GL_ERRORS;
+}
+
+/*
+ * Waits for frames still being encoded, and drops any that weren't read
+ * back yet.
+ */
+void Exporter::destroy()
+{
+	m_pool.reset();
+
+	for ( size_t idx : m_pending ) {
+		glDeleteSync( m_readbacks[ idx ].fence );
+	}
+	m_pending.clear();
+	m_frames.clear();
+	m_tiles_left.clear();
+	m_next_frame = m_count;
+
+	freeTargets();
+}
+
+bool Exporter::start( const std::string &prefix, int first, int count,
+	size_t width, size_t height, float fovy, float zNear, float zFar,
+	float angle0, float angleStep )
+{
+	if ( isBusy() || count <= 0 || width == 0 || height == 0
+		|| width * height > MAX_FRAME_PIXELS ) {
+		return false;
+	}
+
+	m_prefix = prefix;
+	m_first = first;
+	m_count = count;
+	m_width = width;
+	m_height = height;
+	m_fovy = fovy;
+	m_near = zNear;
+	m_far = zFar;
+	m_angle0 = angle0;
+	m_angle_step = angleStep;
+
+	m_next_frame = 0;
+	m_next_x = 0;
+	m_next_y = 0;
+
+	m_rendered = 0;
+	m_slot_waits = 0;
+	m_written = 0;
+	m_failed = 0;
+
+	// Split evenly, so the ring's buffers hold little besides the frame.
+	size_t tiles_x = ( width + m_max_tile - 1 ) / m_max_tile;
+	size_t tiles_y = ( height + m_max_tile - 1 ) / m_max_tile;
+	m_tile_w = ( width + tiles_x - 1 ) / tiles_x;
+	m_tile_h = ( height + tiles_y - 1 ) / tiles_y;
+	m_tiles_per_frame = tiles_x * tiles_y;
+	allocTargets();
+
+	if ( !m_pool ) {
+		// Leave a core for the render loop.
+		unsigned hw = std::thread::hardware_concurrency();
+		m_pool.reset( new ThreadPool( hw > 1 ? hw - 1 : 1 ) );
+	}
+
+	return true;
+}
+
+/*
+ * Called once per frame.  Copies out finished tiles, then renders the
+ * next frame if there are readback slots for all of its tiles and room
+ * to buffer it, leaving the default framebuffer and viewport as it found
+ * them.
+ */
+void Exporter::update( const RenderFn &render )
+{
+	if ( !isBusy() ) {
+		return;
+	}
+
+	harvest();
+
+	size_t frame_bytes = m_width * m_height * 3;
+	size_t buffered = ( m_frames.size() + m_encoding ) * frame_bytes;
+	bool ready = m_next_frame < m_count
+		&& buffered + frame_bytes <= MAX_BUFFERED_BYTES;
+	if ( ready && m_free.size() < m_tiles_per_frame ) {
+		++m_slot_waits;
+		ready = false;
+	}
+
+	if ( ready ) {
+		GLint vp[4];
+		glGetIntegerv( GL_VIEWPORT, vp );
+
+		renderFrame( render );
+
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		glViewport( vp[0], vp[1], vp[2], vp[3] );
+
+		// Make sure the fences reach the GPU, so they can signal.
+		glFlush();
+		CHECK_GL_ERRORS;
+	}
+
+	if ( m_next_frame >= m_count && m_pending.empty() ) {
+		freeTargets();
+	}
+}
+
+bool Exporter::isBusy() const
+{
+	return m_next_frame < m_count || !m_pending.empty()
+		|| !m_frames.empty() || m_encoding > 0;
+}
+
+int Exporter::getFramesTotal() const
+{
+	return m_count;
+}
+
+int Exporter::getFramesRendered() const
+{
+	return m_rendered;
+}
+
+int Exporter::getFramesWritten() const
+{
+	return m_written;
+}
+
+int Exporter::getFramesFailed() const
+{
+	return m_failed;
+}
+
+unsigned Exporter::getSlotWaits() const
+{
+	return m_slot_waits;
+}
+
+void Exporter::allocTargets()
+{
+	if ( m_fbo ) {
+		freeTargets();
+	}
+
+	glGenRenderbuffers( 1, &m_colour_rb );
+	glBindRenderbuffer( GL_RENDERBUFFER, m_colour_rb );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, m_tile_w, m_tile_h );
+
+	glGenRenderbuffers( 1, &m_depth_rb );
+	glBindRenderbuffer( GL_RENDERBUFFER, m_depth_rb );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, m_tile_w, m_tile_h );
+	glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+	glGenFramebuffers( 1, &m_fbo );
+	glBindFramebuffer( GL_FRAMEBUFFER, m_fbo );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_RENDERBUFFER, m_colour_rb );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_RENDERBUFFER, m_depth_rb );
+	if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE ) {
+		std::cerr << "Export framebuffer incomplete" << std::endl;
+	}
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+	size_t num_readbacks = RING_FRAMES * m_tiles_per_frame;
+	m_readbacks.resize( num_readbacks );
+	m_free.clear();
+	for ( size_t i = 0; i < num_readbacks; ++i ) {
+		Readback &rb = m_readbacks[ i ];
+		glGenBuffers( 1, &rb.pbo );
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, rb.pbo );
+		glBufferData( GL_PIXEL_PACK_BUFFER, m_tile_w * m_tile_h * 4,
+			nullptr, GL_STREAM_READ );
+		rb.fence = 0;
+		m_free.push_back( i );
+	}
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	CHECK_GL_ERRORS;
+}
+
+void Exporter::freeTargets()
+{
+	if ( !m_fbo ) {
+		return;
+	}
+
+	for ( Readback &rb : m_readbacks ) {
+		glDeleteBuffers( 1, &rb.pbo );
+	}
+	m_readbacks.clear();
+	m_free.clear();
+
+	glDeleteFramebuffers( 1, &m_fbo );
+	glDeleteRenderbuffers( 1, &m_colour_rb );
+	glDeleteRenderbuffers( 1, &m_depth_rb );
+	m_fbo = 0;
+	m_colour_rb = 0;
+	m_depth_rb = 0;
+}
+
+bool Exporter::nextTile( Tile &tile )
+{
+	if ( m_next_frame >= m_count ) {
+		return false;
+	}
+
+	tile.frame = m_next_frame;
+	tile.x = m_next_x;
+	tile.y = m_next_y;
+	tile.w = std::min( m_tile_w, m_width - m_next_x );
+	tile.h = std::min( m_tile_h, m_height - m_next_y );
+
+	m_next_x += m_tile_w;
+	if ( m_next_x >= m_width ) {
+		m_next_x = 0;
+		m_next_y += m_tile_h;
+		if ( m_next_y >= m_height ) {
+			m_next_y = 0;
+			++m_next_frame;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Renders every tile of the next frame; the caller makes sure there is a
+ * free readback slot for each.
+ */
+void Exporter::renderFrame( const RenderFn &render )
+{
+	int frame = m_next_frame;
+
+	// Every byte is written by a tile, so skip clearing it.
+	m_frames[ frame ] = Pixels( new unsigned char[ m_width * m_height * 3 ],
+		std::default_delete<unsigned char[]>() );
+	m_tiles_left[ frame ] = m_tiles_per_frame;
+
+	Tile tile;
+	while ( m_next_frame == frame && nextTile( tile ) ) {
+		size_t idx = m_free.back();
+		m_free.pop_back();
+		renderTile( tile, m_readbacks[ idx ], render );
+		m_pending.push_back( idx );
+	}
+}
+
+/*
+ * Renders the tile's slice of the frustum and starts reading it back
+ * into the slot's pixel buffer.
+ */
+void Exporter::renderTile( const Tile &tile, Readback &rb, const RenderFn &render )
+{
+	glBindFramebuffer( GL_FRAMEBUFFER, m_fbo );
+	glViewport( 0, 0, tile.w, tile.h );
+	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+	float top = m_near * std::tan( m_fovy / 2.0f );
+	float right = top * float( m_width ) / float( m_height );
+	float x0 = float( tile.x ) / m_width;
+	float x1 = float( tile.x + tile.w ) / m_width;
+	float y0 = float( tile.y ) / m_height;
+	float y1 = float( tile.y + tile.h ) / m_height;
+
+	glm::mat4 P = glm::frustum(
+		-right + 2*right*x0, -right + 2*right*x1,
+		-top + 2*top*y0, -top + 2*top*y1,
+		m_near, m_far );
+
+	render( P, m_angle0 + tile.frame * m_angle_step );
+
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, rb.pbo );
+	glReadPixels( 0, 0, tile.w, tile.h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+	rb.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	rb.tile = tile;
+}
+
+/*
+ * Copies out every readback whose fence has signalled, oldest first,
+ * stopping at the first one still in flight.
+ */
+void Exporter::harvest()
+{
+	while ( !m_pending.empty() ) {
+		size_t idx = m_pending.front();
+		Readback &rb = m_readbacks[ idx ];
+
+		if ( glClientWaitSync( rb.fence, 0, 0 ) == GL_TIMEOUT_EXPIRED ) {
+			break;
+		}
+		glDeleteSync( rb.fence );
+		rb.fence = 0;
+		m_pending.pop_front();
+
+		const Tile &tile = rb.tile;
+		unsigned char *dst = m_frames[ tile.frame ].get();
+
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, rb.pbo );
+		const unsigned char *src = (const unsigned char *)glMapBufferRange(
+			GL_PIXEL_PACK_BUFFER, 0, tile.w * tile.h * 4, GL_MAP_READ_BIT );
+
+		// GL rows run bottom to top, PNG rows top to bottom.  A tile that
+		// can't be mapped comes out black.
+		for ( size_t j = 0; j < tile.h; ++j ) {
+			size_t row = m_height - 1 - ( tile.y + j );
+			unsigned char *d = dst + ( row * m_width + tile.x ) * 3;
+			if ( !src ) {
+				memset( d, 0, tile.w * 3 );
+				continue;
+			}
+
+			const unsigned char *s = src + j * tile.w * 4;
+			for ( size_t i = 0; i < tile.w; ++i ) {
+				d[ 3*i ] = s[ 4*i ];
+				d[ 3*i + 1 ] = s[ 4*i + 1 ];
+				d[ 3*i + 2 ] = s[ 4*i + 2 ];
+			}
+		}
+		if ( src ) {
+			glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+		}
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+		m_free.push_back( idx );
+
+		if ( --m_tiles_left[ tile.frame ] == 0 ) {
+			finishFrame( tile.frame );
+		}
+	}
+}
+
+/*
+ * Hands a fully read back frame to the workers for encoding.
+ */
+void Exporter::finishFrame( int frame )
+{
+	Pixels pixels = m_frames[ frame ];
+	m_frames.erase( frame );
+	m_tiles_left.erase( frame );
+	++m_rendered;
+
+	char name[ 32 ];
+	snprintf( name, sizeof(name), "_%04d.png", m_first + frame );
+	std::string path = m_prefix + name;
+	size_t width = m_width;
+	size_t height = m_height;
+
+	++m_encoding;
+	m_pool->submit( [this, pixels, path, width, height] {
+		if ( writePng( path, pixels.get(), width, height ) ) {
+			++m_written;
+		} else {
+			std::cerr << "Unable to write " << path << std::endl;
+			++m_failed;
+		}
+		--m_encoding;
+	} );
+}
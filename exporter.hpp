@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cs488-framework/OpenGLImport.hpp"
+
+#include "thread_pool.hpp"
+
+/*
+ * Renders frames of the scene offscreen at any resolution and writes them
+ * out as PNGs, without stalling the render loop.
+ *
+ * Each frame is split into tiles no larger than the renderbuffer limit,
+ * each tile rendered into an FBO with its own slice of the frustum, and
+ * read back through a ring of pixel-pack buffers guarded by fences.  The
+ * ring holds two frames' worth of tiles, so a frame never waits on its
+ * own tiles; a tile is only copied out once its fence has signalled, and
+ * finished frames are encoded on worker threads.  update() renders at
+ * most one frame, all of its tiles at once so they show the same scene,
+ * and never blocks on the GPU.
+ */
+class Exporter
+{
+public:
+	// Draws the scene with the given projection, turned by angle radians.
+	typedef std::function<void( const glm::mat4 &proj, float angle )> RenderFn;
+
+	// Largest frame start() accepts, which bounds both the readback ring
+	// (two frames of RGBA) and each frame's pixels (RGB).
+	static const size_t MAX_FRAME_PIXELS = size_t( 8192 ) * 8192;
+
+	Exporter();
+
+	void init();
+	void destroy();
+
+	/*
+	 * Queues count frames of width x height.  Frame i is turned by
+	 * angle0 + i*angleStep and written to <prefix>_<first+i>.png.
+	 * Returns false if an export is still in progress or the frame is
+	 * larger than MAX_FRAME_PIXELS.
+	 */
+	bool start( const std::string &prefix, int first, int count,
+		size_t width, size_t height, float fovy, float zNear, float zFar,
+		float angle0, float angleStep );
+
+	void update( const RenderFn &render );
+
+	// True until every queued frame has been written.
+	bool isBusy() const;
+
+	int getFramesTotal() const;
+	int getFramesRendered() const;
+	int getFramesWritten() const;
+	int getFramesFailed() const;
+
+	// Updates in which the next frame was held back because earlier
+	// frames' tiles were still being read back.
+	unsigned getSlotWaits() const;
+
+private:
+	struct Tile {
+		int frame;
+		size_t x, y; // bottom-left corner, in image pixels from the bottom
+		size_t w, h;
+	};
+
+	struct Readback {
+		GLuint pbo;
+		GLsync fence;
+		Tile tile;
+	};
+
+	void allocTargets();
+	void freeTargets();
+	bool nextTile( Tile &tile );
+	void renderFrame( const RenderFn &render );
+	void renderTile( const Tile &tile, Readback &rb, const RenderFn &render );
+	void harvest();
+	void finishFrame( int frame );
+
+	size_t m_max_tile;
+
+	// Current job
+	std::string m_prefix;
+	int m_first;
+	int m_count;
+	size_t m_width;
+	size_t m_height;
+	float m_fovy, m_near, m_far;
+	float m_angle0, m_angle_step;
+
+	// Next tile to render
+	int m_next_frame;
+	size_t m_next_x;
+	size_t m_next_y;
+
+	// Offscreen target, sized to one tile
+	GLuint m_fbo;
+	GLuint m_colour_rb;
+	GLuint m_depth_rb;
+	size_t m_tile_w;
+	size_t m_tile_h;
+	size_t m_tiles_per_frame;
+
+	// Readback ring: free slots and slots in flight, oldest first
+	std::vector<Readback> m_readbacks;
+	std::vector<size_t> m_free;
+	std::deque<size_t> m_pending;
+
+	// Frames being assembled from tiles, with the tiles still missing
+	typedef std::shared_ptr<unsigned char> Pixels;
+	std::map<int, Pixels> m_frames;
+	std::map<int, size_t> m_tiles_left;
+
+	int m_rendered;
+	unsigned m_slot_waits;
+	std::atomic<int> m_encoding;
+	std::atomic<int> m_written;
+	std::atomic<int> m_failed;
+
+	// Declared last so workers are joined before anything they touch goes.
+	std::unique_ptr<ThreadPool> m_pool;
+};
@@ -48,3 +48,19 @@ void Grid::setColour( int x, int y, int c )
 {
 	m_cols[ y * m_dim + x ] = c;
 }
+
+const int *Grid::getHeights() const
+{
+	return m_heights;
+}
+
+const int *Grid::getColours() const
+{
+	return m_cols;
+}
+
+void Grid::swapStorage( int *&heights, int *&cols )
+{
+	std::swap( m_heights, heights );
+	std::swap( m_cols, cols );
+}
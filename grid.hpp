@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 class Grid
 {
 public:
@@ -15,6 +17,13 @@ public:
 
 	void setHeight( int x, int y, int h );
 	void setColour( int x, int y, int c );
+
+	// Raw storage, dim*dim cells indexed y * dim + x.
+	const int *getHeights() const;
+	const int *getColours() const;
+
+	// Exchange storage with a pair of dim*dim arrays (e.g. a back buffer).
+	void swapStorage( int *&heights, int *&cols );
 	
 private:
 	size_t m_dim;
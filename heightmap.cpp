@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "heightmap.hpp"
+#include "image_reader.hpp"
+#include "thread_pool.hpp"
+
+// Stripes shorter than this aren't worth a thread.
+static const size_t MIN_STRIPE_ROWS = 256;
+
+/*
+ * Per-cell totals for a band of image rows; stripes are summed at the end.
+ */
+struct Accum
+{
+	std::vector<uint64_t> sum;
+	std::vector<uint64_t> count;
+	std::vector<uint32_t> classes; // numColours counts per cell
+
+	std::string error;
+	bool ok;
+};
+
+/*
+ * First pixel of each of the dim cells along an axis of n pixels, plus
+ * an end marker.  Every cell gets at least one pixel, so an image
+ * smaller than the grid is stretched rather than leaving holes.
+ */
+static void cellBounds( size_t n, size_t dim,
+	std::vector<size_t> &first, std::vector<size_t> &last )
+{
+	first.resize( dim );
+	last.resize( dim );
+	for ( size_t i = 0; i < dim; ++i ) {
+		first[i] = std::min( i * n / dim, n - 1 );
+		last[i] = std::max( ( i + 1 ) * n / dim, first[i] + 1 );
+	}
+}
+
+/*
+ * Accumulates image rows [y0, y1) into acc, with readers of its own.
+ */
+static void accumulateStripe( const std::string &heightPath,
+	const std::string &colourPath, size_t dim, size_t numColours,
+	size_t y0, size_t y1, Accum &acc )
+{
+	acc.ok = false;
+
+	ImageReader heights;
+	ImageReader colours;
+	bool use_colours = !colourPath.empty();
+	if ( !heights.open( heightPath ) || !heights.seekRow( y0 ) ) {
+		acc.error = heights.getError();
+		return;
+	}
+	if ( use_colours && ( !colours.open( colourPath ) || !colours.seekRow( y0 ) ) ) {
+		acc.error = colours.getError();
+		return;
+	}
+
+	size_t width = heights.getWidth();
+	size_t height = heights.getHeight();
+
+	std::vector<size_t> col_first, col_last, row_first, row_last;
+	cellBounds( width, dim, col_first, col_last );
+	cellBounds( height, dim, row_first, row_last );
+
+	std::vector<uint16_t> hrow( width );
+	std::vector<uint16_t> crow( use_colours ? width : 0 );
+
+	for ( size_t y = y0; y < y1; ++y ) {
+		if ( !heights.readRow( hrow.data() ) ) {
+			acc.error = heights.getError();
+			return;
+		}
+		if ( use_colours && !colours.readRow( crow.data() ) ) {
+			acc.error = colours.getError();
+			return;
+		}
+
+		for ( size_t cz = 0; cz < dim; ++cz ) {
+			if ( y < row_first[cz] || y >= row_last[cz] ) {
+				continue;
+			}
+
+			for ( size_t cx = 0; cx < dim; ++cx ) {
+				size_t cell = cz * dim + cx;
+
+				uint64_t s = 0;
+				for ( size_t x = col_first[cx]; x < col_last[cx]; ++x ) {
+					s += hrow[x];
+				}
+				acc.sum[ cell ] += s;
+				acc.count[ cell ] += col_last[cx] - col_first[cx];
+
+				if ( use_colours ) {
+					uint32_t *hist = &acc.classes[ cell * numColours ];
+					for ( size_t x = col_first[cx]; x < col_last[cx]; ++x ) {
+						++hist[ crow[x] % numColours ];
+					}
+				}
+			}
+		}
+	}
+
+	acc.ok = true;
+}
+
+bool importHeightmap( const std::string &heightPath,
+	const std::string &colourPath, Grid &grid, int maxHeight,
+	size_t numColours, std::string &error )
+{
+	size_t dim = grid.getDim();
+	numColours = std::max( numColours, size_t( 1 ) );
+
+	// Probe the images for their size and whether they can be striped.
+	ImageReader heights;
+	if ( !heights.open( heightPath ) ) {
+		error = heights.getError();
+		return false;
+	}
+	size_t width = heights.getWidth();
+	size_t height = heights.getHeight();
+	unsigned maxval = heights.getMaxValue();
+	bool seekable = heights.canSeek();
+	heights.close();
+
+	if ( width == 0 || height == 0 ) {
+		error = heightPath + ": image is empty";
+		return false;
+	}
+
+	if ( !colourPath.empty() ) {
+		ImageReader colours;
+		if ( !colours.open( colourPath ) ) {
+			error = colours.getError();
+			return false;
+		}
+		if ( colours.getWidth() != width || colours.getHeight() != height ) {
+			error = colourPath + ": size differs from " + heightPath;
+			return false;
+		}
+		seekable = seekable && colours.canSeek();
+	}
+
+	std::unique_ptr<ThreadPool> pool;
+	size_t num_stripes = 1;
+	if ( seekable && height >= 2 * MIN_STRIPE_ROWS ) {
+		pool.reset( new ThreadPool() );
+		num_stripes = std::min( pool->getNumThreads(), height / MIN_STRIPE_ROWS );
+	}
+
+	std::vector<Accum> accums( num_stripes );
+	for ( size_t i = 0; i < num_stripes; ++i ) {
+		Accum &acc = accums[i];
+		acc.sum.assign( dim * dim, 0 );
+		acc.count.assign( dim * dim, 0 );
+		acc.classes.assign( colourPath.empty() ? 0 : dim * dim * numColours, 0 );
+
+		size_t y0 = height * i / num_stripes;
+		size_t y1 = height * ( i + 1 ) / num_stripes;
+		if ( pool ) {
+			pool->submit( [&heightPath, &colourPath, dim, numColours, y0, y1, &acc] {
+				accumulateStripe( heightPath, colourPath, dim, numColours, y0, y1, acc );
+			} );
+		} else {
+			accumulateStripe( heightPath, colourPath, dim, numColours, y0, y1, acc );
+		}
+	}
+	if ( pool ) {
+		pool->wait();
+	}
+
+	Accum &total = accums[0];
+	for ( size_t i = 0; i < num_stripes; ++i ) {
+		if ( !accums[i].ok ) {
+			error = accums[i].error;
+			return false;
+		}
+		if ( i == 0 ) {
+			continue;
+		}
+		for ( size_t j = 0; j < total.sum.size(); ++j ) {
+			total.sum[j] += accums[i].sum[j];
+			total.count[j] += accums[i].count[j];
+		}
+		for ( size_t j = 0; j < total.classes.size(); ++j ) {
+			total.classes[j] += accums[i].classes[j];
+		}
+	}
+
+	// Every cell should have pixels; don't touch the grid if one doesn't.
+	for ( size_t cell = 0; cell < dim * dim; ++cell ) {
+		if ( total.count[ cell ] == 0 ) {
+			error = heightPath + ": no pixels for some cells";
+			return false;
+		}
+	}
+
+	for ( size_t z = 0; z < dim; ++z ) {
+		for ( size_t x = 0; x < dim; ++x ) {
+			size_t cell = z * dim + x;
+
+			double mean = double( total.sum[ cell ] ) / total.count[ cell ];
+			int h = int( mean / maxval * maxHeight + 0.5 );
+			grid.setHeight( x, z, std::min( std::max( h, 0 ), maxHeight ) );
+
+			int c = 0;
+			if ( !total.classes.empty() ) {
+				const uint32_t *hist = &total.classes[ cell * numColours ];
+				c = int( std::max_element( hist, hist + numColours ) - hist );
+			}
+			grid.setColour( x, z, c );
+		}
+	}
+
+	return true;
+}
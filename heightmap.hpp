@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+#include "grid.hpp"
+
+/*
+ * Fills grid from a heightmap image, streamed a row at a time (see
+ * ImageReader).  Each cell takes the mean of the pixels covering it,
+ * scaled from the image's range to [0, maxHeight].
+ *
+ * If colourPath is not empty it names a class image of the same size;
+ * each cell takes the most common class among its pixels, modulo
+ * numColours.  Otherwise every cell gets colour 0.
+ *
+ * Memory use depends on the image width and grid size, not the image
+ * height.  Seekable images (PGM) are decoded in parallel horizontal
+ * stripes.  On failure returns false with a message in error, leaving
+ * grid untouched.
+ */
+bool importHeightmap( const std::string &heightPath,
+	const std::string &colourPath, Grid &grid, int maxHeight,
+	size_t numColours, std::string &error );
@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "image_reader.hpp"
+
+// Compressed PNG data read from the file at a time.
+static const size_t INPUT_SIZE = 1 << 16;
+
+static uint32_t getU32( const unsigned char *p )
+{
+	return ( uint32_t( p[0] ) << 24 ) | ( uint32_t( p[1] ) << 16 )
+		| ( uint32_t( p[2] ) << 8 ) | uint32_t( p[3] );
+}
+
+static int paeth( int a, int b, int c )
+{
+	int p = a + b - c;
+	int pa = abs( p - a );
+	int pb = abs( p - b );
+	int pc = abs( p - c );
+	if ( pa <= pb && pa <= pc ) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+/*
+ * Reads the next whitespace-separated token of a PNM header, skipping
+ * comments.
+ */
+static bool pnmToken( FILE *f, std::string &tok )
+{
+	tok.clear();
+	int ch = fgetc( f );
+	for ( ;; ) {
+		if ( ch == '#' ) {
+			while ( ch != EOF && ch != '\n' ) {
+				ch = fgetc( f );
+			}
+		} else if ( ch != EOF && isspace( ch ) ) {
+			ch = fgetc( f );
+		} else {
+			break;
+		}
+	}
+
+	while ( ch != EOF && !isspace( ch ) ) {
+		tok += char( ch );
+		ch = fgetc( f );
+	}
+	// The single whitespace after the last header field is consumed here.
+	return !tok.empty();
+}
+
+ImageReader::ImageReader()
+	: m_file( nullptr )
+	, m_format( NONE )
+	, m_width( 0 )
+	, m_height( 0 )
+	, m_maxval( 0 )
+	, m_sample_bytes( 1 )
+	, m_row( 0 )
+	, m_data_offset( 0 )
+	, m_zs( z_stream() )
+	, m_z_init( false )
+	, m_chunk_left( 0 )
+	, m_idat_done( false )
+{}
+
+ImageReader::~ImageReader()
+{
+	close();
+}
+
+bool ImageReader::open( const std::string &path )
+{
+	close();
+	m_path = path;
+
+	m_file = fopen( path.c_str(), "rb" );
+	if ( !m_file ) {
+		return fail( "unable to open file" );
+	}
+
+	unsigned char magic[2] = { 0, 0 };
+	if ( fread( magic, 1, 2, m_file ) != 2 ) {
+		return fail( "unable to read header" );
+	}
+	rewind( m_file );
+
+	if ( magic[0] == 'P' && magic[1] == '5' ) {
+		return openPgm();
+	} else if ( magic[0] == 137 && magic[1] == 'P' ) {
+		return openPng();
+	}
+	return fail( "not a binary PGM or PNG image" );
+}
+
+void ImageReader::close()
+{
+	if ( m_z_init ) {
+		inflateEnd( &m_zs );
+		m_z_init = false;
+	}
+	if ( m_file ) {
+		fclose( m_file );
+		m_file = nullptr;
+	}
+	m_format = NONE;
+	m_row = 0;
+}
+
+size_t ImageReader::getWidth() const
+{
+	return m_width;
+}
+
+size_t ImageReader::getHeight() const
+{
+	return m_height;
+}
+
+unsigned ImageReader::getMaxValue() const
+{
+	return m_maxval;
+}
+
+const std::string &ImageReader::getError() const
+{
+	return m_error;
+}
+
+bool ImageReader::canSeek() const
+{
+	return m_format == PGM;
+}
+
+bool ImageReader::seekRow( size_t y )
+{
+	if ( y == m_row ) {
+		return true;
+	}
+	if ( m_format != PGM || y > m_height ) {
+		return fail( "can't seek to row" );
+	}
+
+	long offset = m_data_offset + long( y * m_width * m_sample_bytes );
+	if ( fseek( m_file, offset, SEEK_SET ) != 0 ) {
+		return fail( "seek failed" );
+	}
+	m_row = y;
+	return true;
+}
+
+bool ImageReader::readRow( uint16_t *samples )
+{
+	if ( m_format == NONE || m_row >= m_height ) {
+		return fail( "no more rows" );
+	}
+
+	const unsigned char *src = nullptr;
+	if ( m_format == PGM ) {
+		if ( fread( m_raw.data(), 1, m_raw.size(), m_file ) != m_raw.size() ) {
+			return fail( "unexpected end of file" );
+		}
+		src = m_raw.data();
+	} else {
+		if ( !readPngRow() ) {
+			return false;
+		}
+		src = m_cur.data() + 1;
+	}
+
+	// Both formats store 16-bit samples big-endian.
+	if ( m_sample_bytes == 2 ) {
+		for ( size_t x = 0; x < m_width; ++x ) {
+			samples[x] = uint16_t( ( src[ 2*x ] << 8 ) | src[ 2*x + 1 ] );
+		}
+	} else {
+		for ( size_t x = 0; x < m_width; ++x ) {
+			samples[x] = src[x];
+		}
+	}
+
+	++m_row;
+	return true;
+}
+
+bool ImageReader::fail( const std::string &msg )
+{
+	m_error = m_path + ": " + msg;
+	return false;
+}
+
+bool ImageReader::openPgm()
+{
+	std::string magic, w, h, maxval;
+	if ( !pnmToken( m_file, magic ) || !pnmToken( m_file, w )
+		|| !pnmToken( m_file, h ) || !pnmToken( m_file, maxval ) ) {
+		return fail( "truncated PGM header" );
+	}
+
+	m_width = strtoul( w.c_str(), nullptr, 10 );
+	m_height = strtoul( h.c_str(), nullptr, 10 );
+	m_maxval = unsigned( strtoul( maxval.c_str(), nullptr, 10 ) );
+	if ( m_width == 0 || m_height == 0 || m_maxval == 0 || m_maxval > 65535 ) {
+		return fail( "bad PGM header" );
+	}
+
+	m_sample_bytes = m_maxval > 255 ? 2 : 1;
+	m_data_offset = ftell( m_file );
+	m_raw.resize( m_width * m_sample_bytes );
+	m_format = PGM;
+	m_row = 0;
+	return true;
+}
+
+bool ImageReader::openPng()
+{
+	unsigned char sig[8];
+	unsigned char hdr[8];
+	unsigned char ihdr[13];
+	if ( fread( sig, 1, 8, m_file ) != 8 || fread( hdr, 1, 8, m_file ) != 8
+		|| memcmp( hdr + 4, "IHDR", 4 ) != 0 || getU32( hdr ) != 13
+		|| fread( ihdr, 1, 13, m_file ) != 13 ) {
+		return fail( "bad PNG header" );
+	}
+
+	m_width = getU32( ihdr );
+	m_height = getU32( ihdr + 4 );
+	int depth = ihdr[8];
+	int colour_type = ihdr[9];
+	int interlace = ihdr[12];
+
+	if ( m_width == 0 || m_height == 0 ) {
+		return fail( "bad PNG header" );
+	}
+	if ( ( colour_type != 0 && colour_type != 3 ) || interlace != 0
+		|| ( depth != 8 && !( depth == 16 && colour_type == 0 ) ) ) {
+		return fail( "only non-interlaced 8/16-bit greyscale or 8-bit indexed PNGs are supported" );
+	}
+	m_sample_bytes = depth / 8;
+	m_maxval = depth == 16 ? 65535 : 255;
+
+	// Skip the IHDR CRC and any chunks up to the first IDAT.
+	fseek( m_file, 4, SEEK_CUR );
+	for ( ;; ) {
+		if ( fread( hdr, 1, 8, m_file ) != 8 ) {
+			return fail( "no image data" );
+		}
+		if ( memcmp( hdr + 4, "IDAT", 4 ) == 0 ) {
+			m_chunk_left = getU32( hdr );
+			break;
+		}
+		fseek( m_file, long( getU32( hdr ) ) + 4, SEEK_CUR );
+	}
+
+	m_zs = z_stream();
+	if ( inflateInit( &m_zs ) != Z_OK ) {
+		return fail( "inflateInit failed" );
+	}
+	m_z_init = true;
+	m_idat_done = false;
+
+	m_in.resize( INPUT_SIZE );
+	m_cur.assign( 1 + m_width * m_sample_bytes, 0 );
+	m_prev.assign( m_cur.size(), 0 );
+	m_format = PNG;
+	m_row = 0;
+	return true;
+}
+
+/*
+ * Refills the inflate input from the current IDAT chunk, moving on to
+ * the next one when it runs out.
+ */
+bool ImageReader::fillPngInput()
+{
+	unsigned char hdr[8];
+	while ( m_chunk_left == 0 ) {
+		// CRC of the finished chunk, then the next chunk's header.
+		if ( m_idat_done || fseek( m_file, 4, SEEK_CUR ) != 0
+			|| fread( hdr, 1, 8, m_file ) != 8
+			|| memcmp( hdr + 4, "IDAT", 4 ) != 0 ) {
+			m_idat_done = true;
+			return fail( "image data ends early" );
+		}
+		m_chunk_left = getU32( hdr );
+	}
+
+	size_t n = std::min( size_t( m_chunk_left ), m_in.size() );
+	if ( fread( m_in.data(), 1, n, m_file ) != n ) {
+		return fail( "unexpected end of file" );
+	}
+	m_chunk_left -= uint32_t( n );
+	m_zs.next_in = m_in.data();
+	m_zs.avail_in = uInt( n );
+	return true;
+}
+
+/*
+ * Inflates the next scanline into m_cur and undoes its filter.
+ */
+bool ImageReader::readPngRow()
+{
+	m_prev.swap( m_cur );
+
+	m_zs.next_out = m_cur.data();
+	m_zs.avail_out = uInt( m_cur.size() );
+	while ( m_zs.avail_out > 0 ) {
+		int res = inflate( &m_zs, Z_NO_FLUSH );
+		if ( res == Z_STREAM_END ) {
+			if ( m_zs.avail_out > 0 ) {
+				return fail( "image data ends early" );
+			}
+			break;
+		}
+		if ( res != Z_OK && res != Z_BUF_ERROR ) {
+			return fail( "corrupt image data" );
+		}
+
+		// Only go back to the file once inflate has used up its input.
+		if ( m_zs.avail_out > 0 && m_zs.avail_in == 0 && !fillPngInput() ) {
+			return false;
+		}
+	}
+
+	unsigned char *row = m_cur.data() + 1;
+	const unsigned char *prior = m_prev.data() + 1;
+	size_t len = m_cur.size() - 1;
+	size_t bpp = m_sample_bytes;
+	if ( m_row == 0 ) {
+		std::fill( m_prev.begin(), m_prev.end(), 0 );
+	}
+
+	switch ( m_cur[0] ) {
+	case 0:
+		break;
+	case 1:
+		for ( size_t i = bpp; i < len; ++i ) {
+			row[i] += row[ i - bpp ];
+		}
+		break;
+	case 2:
+		for ( size_t i = 0; i < len; ++i ) {
+			row[i] += prior[i];
+		}
+		break;
+	case 3:
+		for ( size_t i = 0; i < len; ++i ) {
+			int left = i >= bpp ? row[ i - bpp ] : 0;
+			row[i] += ( left + prior[i] ) / 2;
+		}
+		break;
+	case 4:
+		for ( size_t i = 0; i < len; ++i ) {
+			int left = i >= bpp ? row[ i - bpp ] : 0;
+			int up_left = i >= bpp ? prior[ i - bpp ] : 0;
+			row[i] += paeth( left, prior[i], up_left );
+		}
+		break;
+	default:
+		return fail( "bad filter type" );
+	}
+
+	return true;
+}
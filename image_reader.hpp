@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+/*
+ * Reads a single-channel image one row at a time, never holding more
+ * than a couple of rows in memory.
+ *
+ * Supported: binary PGM (P5, 8 or 16 bit) and non-interlaced PNG that is
+ * greyscale (8 or 16 bit) or palette-indexed (8 bit, read as indices).
+ * PGM rows can be read in any order with seekRow(); PNG rows only in
+ * order, since they come out of one deflate stream.
+ */
+class ImageReader
+{
+public:
+	ImageReader();
+	~ImageReader();
+
+	bool open( const std::string &path );
+	void close();
+
+	size_t getWidth() const;
+	size_t getHeight() const;
+	unsigned getMaxValue() const;
+	const std::string &getError() const;
+
+	bool canSeek() const;
+	bool seekRow( size_t y );
+
+	// Reads the next row as getWidth() samples in [0, getMaxValue()].
+	bool readRow( uint16_t *samples );
+
+private:
+	enum Format {
+		NONE,
+		PGM,
+		PNG
+	};
+
+	bool openPgm();
+	bool openPng();
+	bool readPngRow();
+	bool fillPngInput();
+	bool fail( const std::string &msg );
+
+	FILE *m_file;
+	Format m_format;
+	std::string m_path;
+	std::string m_error;
+
+	size_t m_width;
+	size_t m_height;
+	unsigned m_maxval;
+	size_t m_sample_bytes;
+	size_t m_row;
+
+	// PGM
+	long m_data_offset;
+	std::vector<unsigned char> m_raw;
+
+	// PNG: the deflate stream, its input, and the current and previous
+	// scanlines (filter byte first) for unfiltering.
+	z_stream m_zs;
+	bool m_z_init;
+	std::vector<unsigned char> m_in;
+	uint32_t m_chunk_left;
+	bool m_idat_done;
+	std::vector<unsigned char> m_cur;
+	std::vector<unsigned char> m_prev;
+};
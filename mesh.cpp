@@ -0,0 +1,85 @@
+#include <algorithm>
+
+#include "mesh.hpp"
+
+void buildGridLines( size_t dim, std::vector<float> &verts )
+{
+	verts.resize( 3 * 2 * 2 * ( dim + 3 ) );
+
+	size_t ct = 0;
+	for ( int idx = 0; idx < int( dim ) + 3; ++idx ) {
+		verts[ ct ] = -1;
+		verts[ ct+1 ] = 0;
+		verts[ ct+2 ] = idx-1;
+		verts[ ct+3 ] = dim+1;
+		verts[ ct+4 ] = 0;
+		verts[ ct+5 ] = idx-1;
+		ct += 6;
+
+		verts[ ct ] = idx-1;
+		verts[ ct+1 ] = 0;
+		verts[ ct+2 ] = -1;
+		verts[ ct+3 ] = idx-1;
+		verts[ ct+4 ] = 0;
+		verts[ ct+5 ] = dim+1;
+		ct += 6;
+	}
+}
+
+void buildColumnInstances( const Grid &grid, const float *palette,
+	int skip_x, int skip_z, std::vector<BlockInstance> &insts )
+{
+	int dim = int( grid.getDim() );
+
+	insts.clear();
+	for ( int x = 0; x < dim; x++ ) {
+		for ( int z = 0; z < dim; z++ ) {
+			if ( x == skip_x && z == skip_z ) {
+				continue;
+			}
+
+			int h = grid.getHeight( x, z );
+			if ( h <= 0 ) {
+				continue;
+			}
+
+			const float *c = palette + 3 * grid.getColour( x, z );
+			insts.push_back( BlockInstance() );
+			setInstance( insts.back(), x, 0, z, h, c[0], c[1], c[2] );
+		}
+	}
+}
+
+size_t buildColumnBlocks( const Grid &grid, const float *palette,
+	int x, int z, BlockInstance *out, size_t capacity )
+{
+	if ( capacity == 0 ) {
+		return 0;
+	}
+
+	int h = std::max( grid.getHeight( x, z ), 0 );
+	h = std::min( h, int( ( capacity - 1 ) / 2 ) );
+	const float *c = palette + 3 * grid.getColour( x, z );
+
+	size_t ct = 0;
+	for ( int y = 0; y < h; y++ ) {
+		setInstance( out[ ct++ ], x, y, z, 1, c[0], c[1], c[2] );
+	}
+	for ( int y = 0; y < h+1; y++ ) {
+		setInstance( out[ ct++ ], x, y, z, 1, 0, 0, 0 );
+	}
+	return ct;
+}
+
+void packColumns( const Grid &grid, std::vector<int> &cols )
+{
+	size_t dim = grid.getDim();
+	const int *heights = grid.getHeights();
+	const int *colours = grid.getColours();
+
+	cols.resize( dim * dim * 2 );
+	for ( size_t i = 0; i < dim * dim; ++i ) {
+		cols[ 2*i ] = heights[i];
+		cols[ 2*i + 1 ] = colours[i];
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+#include "block_instance.hpp"
+#include "grid.hpp"
+
+/*
+ * CPU-side geometry for the scene, kept free of GL so it can be
+ * benchmarked on its own.
+ */
+
+// Line segments (xyz pairs) of the floor grid, with a one-cell border.
+void buildGridLines( size_t dim, std::vector<float> &verts );
+
+// One instance per non-empty column, skipping (skip_x, skip_z): the unit
+// cube scaled to the column's height, coloured from palette (rgb triples).
+void buildColumnInstances( const Grid &grid, const float *palette,
+	int skip_x, int skip_z, std::vector<BlockInstance> &insts );
+
+// The unit blocks of column (x, z) in its colour, then a black outline for
+// every level plus one on top, 2*height+1 instances in all.  Taller
+// columns are cut down to fit in capacity.  Returns the number written
+// (the first (n-1)/2 are the solid blocks).
+size_t buildColumnBlocks( const Grid &grid, const float *palette,
+	int x, int z, BlockInstance *out, size_t capacity );
+
+// Height and colour of every column, interleaved, in grid order.
+void packColumns( const Grid &grid, std::vector<int> &cols );
@@ -0,0 +1,127 @@
+#include <cstdio>
+#include <vector>
+
+#include <zlib.h>
+
+#include "png_writer.hpp"
+
+// Size of each IDAT chunk written out of the deflate stream.
+static const size_t CHUNK_SIZE = 1 << 16;
+
+static void putU32( unsigned char *p, unsigned long v )
+{
+	p[0] = (unsigned char)( v >> 24 );
+	p[1] = (unsigned char)( v >> 16 );
+	p[2] = (unsigned char)( v >> 8 );
+	p[3] = (unsigned char)( v );
+}
+
+static bool writeChunk( FILE *f, const char *type,
+	const unsigned char *data, size_t len )
+{
+	unsigned char hdr[8];
+	putU32( hdr, len );
+	hdr[4] = type[0];
+	hdr[5] = type[1];
+	hdr[6] = type[2];
+	hdr[7] = type[3];
+
+	unsigned long crc = crc32( 0, hdr + 4, 4 );
+	if ( len > 0 ) {
+		crc = crc32( crc, data, uInt( len ) );
+	}
+
+	unsigned char tail[4];
+	putU32( tail, crc );
+
+	return fwrite( hdr, 1, 8, f ) == 8
+		&& ( len == 0 || fwrite( data, 1, len, f ) == len )
+		&& fwrite( tail, 1, 4, f ) == 4;
+}
+
+/*
+ * Pushes len bytes through the deflate stream, writing an IDAT chunk
+ * each time the output buffer fills.  With Z_FINISH, also drains the
+ * stream and writes the last partial chunk.
+ */
+static bool deflateInto( FILE *f, z_stream &zs, std::vector<unsigned char> &out,
+	const unsigned char *data, size_t len, int flush )
+{
+	zs.next_in = const_cast<unsigned char *>( data );
+	zs.avail_in = uInt( len );
+
+	for ( ;; ) {
+		int res = deflate( &zs, flush );
+		if ( res == Z_STREAM_ERROR ) {
+			return false;
+		}
+
+		bool done = flush == Z_FINISH ? res == Z_STREAM_END
+			: zs.avail_in == 0 && zs.avail_out > 0;
+
+		if ( zs.avail_out == 0 || ( done && flush == Z_FINISH ) ) {
+			if ( !writeChunk( f, "IDAT", out.data(), out.size() - zs.avail_out ) ) {
+				return false;
+			}
+			zs.next_out = out.data();
+			zs.avail_out = uInt( out.size() );
+		}
+
+		if ( done ) {
+			return true;
+		}
+	}
+}
+
+/*
+ * Rows are deflated one at a time, each prefixed with filter type 0, and
+ * the compressed stream is written out as IDAT chunks as it fills, so no
+ * second copy of the image is ever held.  Renders are mostly flat colour,
+ * so the fastest compression level loses little.
+ */
+bool writePng( const std::string &path, const unsigned char *rgb,
+	size_t width, size_t height )
+{
+	FILE *f = fopen( path.c_str(), "wb" );
+	if ( !f ) {
+		return false;
+	}
+
+	static const unsigned char sig[] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+	bool ok = fwrite( sig, 1, sizeof(sig), f ) == sizeof(sig);
+
+	unsigned char ihdr[13];
+	putU32( ihdr, width );
+	putU32( ihdr + 4, height );
+	ihdr[8] = 8;  // bit depth
+	ihdr[9] = 2;  // colour type: RGB
+	ihdr[10] = 0; // deflate
+	ihdr[11] = 0; // adaptive filtering
+	ihdr[12] = 0; // no interlace
+	ok = ok && writeChunk( f, "IHDR", ihdr, sizeof(ihdr) );
+
+	z_stream zs = z_stream();
+	bool z_init = ok && deflateInit( &zs, Z_BEST_SPEED ) == Z_OK;
+	ok = z_init;
+
+	std::vector<unsigned char> out( CHUNK_SIZE );
+	zs.next_out = out.data();
+	zs.avail_out = uInt( out.size() );
+
+	size_t stride = width * 3;
+	const unsigned char filter = 0;
+	for ( size_t y = 0; ok && y < height; ++y ) {
+		ok = deflateInto( f, zs, out, &filter, 1, Z_NO_FLUSH )
+			&& deflateInto( f, zs, out, rgb + y * stride, stride, Z_NO_FLUSH );
+	}
+	ok = ok && deflateInto( f, zs, out, nullptr, 0, Z_FINISH );
+
+	if ( z_init ) {
+		deflateEnd( &zs );
+	}
+
+	ok = ok && writeChunk( f, "IEND", nullptr, 0 );
+	ok = ( fclose( f ) == 0 ) && ok;
+
+	return ok;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+/*
+ * Writes 8-bit RGB pixels (top row first, no row padding) as a PNG.
+ * Returns false if the file couldn't be written.
+ */
+bool writePng( const std::string &path, const unsigned char *rgb,
+	size_t width, size_t height );
@@ -18,7 +18,8 @@ if os.get() == "macosx" then
     linkLibs = {
         "cs488-framework",
         "imgui",
-        "glfw3"
+        "glfw3",
+        "z"
     }
 end
 
@@ -36,7 +37,8 @@ if os.get() == "linux" then
         "X11",
         "stdc++",
         "dl",
-        "pthread"
+        "pthread",
+        "z"
     }
 end
 
@@ -70,3 +72,21 @@ solution "CS488-Projects"
     configuration "Release"
         defines { "NDEBUG" }
         flags { "Optimize" }
+
+    -- Micro-benchmarks for the grid and mesh code; no GL or GLFW needed.
+    project "grid-bench"
+        kind "ConsoleApp"
+        language "C++"
+        location "build/grid-bench"
+        objdir "build/grid-bench"
+        targetdir "."
+        buildoptions (buildOptions)
+        files { "bench/*.cpp", "grid.cpp", "mesh.cpp" }
+
+    configuration "Debug"
+        defines { "DEBUG" }
+        flags { "Symbols" }
+
+    configuration "Release"
+        defines { "NDEBUG" }
+        flags { "Optimize" }
@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <cstring>
+
+#include "simulation.hpp"
+
+// Tiles are copied into a local buffer with an apron of PAD cells on
+// every side (zero height, marked invalid outside the grid), so the
+// kernels below read neighbours without bounds checks.  Erosion needs
+// three: whether a tile cell's block is taken depends on the other cells
+// sending to its target.
+static const int PAD = 3;
+static const int STRIDE = Simulation::TILE + 2 * PAD;
+static const int LOCAL = STRIDE * STRIDE;
+
+// Below this many dirty tiles a step runs on the calling thread.
+static const size_t PARALLEL_MIN_TILES = 16;
+
+// Neighbour offsets in a local buffer: west, east, north, south.  The
+// opposite of direction k is k^1.
+static const int NEIGHBOURS[4] = { -1, 1, -STRIDE, STRIDE };
+
+const size_t Simulation::TILE;
+
+/*
+ * Colour of the first neighbour (west, east, north, south) whose flag is
+ * set, else the south one.  Flags are 0 or 1; the selects are masks so
+ * the loops around it stay free of branches.
+ */
+static inline int firstDonor( int w, int e, int n, int cw, int ce, int cn, int cs )
+{
+	int d = cs;
+	d ^= ( d ^ cn ) & -n;
+	d ^= ( d ^ ce ) & -e;
+	d ^= ( d ^ cw ) & -w;
+	return d;
+}
+
+// A column that was empty takes its new blocks' colour.
+static inline int newColour( int h, int nh, int c, int donor )
+{
+	int fill = -( ( h == 0 ) & ( nh > 0 ) );
+	return c ^ ( ( c ^ donor ) & fill );
+}
+
+/*
+ * The kernels below compute new heights and colours for a whole TILE x
+ * TILE block from its local buffer (lh, lc, lv) into nh/nc (row stride
+ * TILE); cells past the edge of the grid are computed too and dropped by
+ * the caller.  Rows have a fixed width and no branches, so the inner
+ * loops vectorize (-O2 and up).
+ */
+
+static void sandpileKernel( const int *lh, const int *lc, int maxHeight,
+	int *nh, int *nc )
+{
+	for ( size_t lz = 0; lz < Simulation::TILE; ++lz ) {
+		const int *h = lh + ( lz + PAD ) * STRIDE + PAD;
+		const int *c = lc + ( lz + PAD ) * STRIDE + PAD;
+		int *oh = nh + lz * Simulation::TILE;
+		int *oc = nc + lz * Simulation::TILE;
+
+		for ( size_t x = 0; x < Simulation::TILE; ++x ) {
+			int w = h[ x-1 ] >= 4;
+			int e = h[ x+1 ] >= 4;
+			int n = h[ x-STRIDE ] >= 4;
+			int s = h[ x+STRIDE ] >= 4;
+
+			int v = std::min( h[x] - 4 * ( h[x] >= 4 ) + w + e + n + s, maxHeight );
+			oh[x] = v;
+
+			int donor = firstDonor( w, e, n,
+				c[ x-1 ], c[ x+1 ], c[ x-STRIDE ], c[ x+STRIDE ] );
+			oc[x] = newColour( h[x], v, c[x], donor );
+		}
+	}
+}
+
+/*
+ * A receiver is at least SLOPE+1 below each of its senders, so it gains
+ * at most 4 and stays within the maximum height without a cap.
+ */
+static void gravityKernel( const int *lh, const int *lc, const int *lv,
+	int *nh, int *nc )
+{
+	static const int SLOPE = 3;
+
+	for ( size_t lz = 0; lz < Simulation::TILE; ++lz ) {
+		const int *h = lh + ( lz + PAD ) * STRIDE + PAD;
+		const int *c = lc + ( lz + PAD ) * STRIDE + PAD;
+		const int *v = lv + ( lz + PAD ) * STRIDE + PAD;
+		int *oh = nh + lz * Simulation::TILE;
+		int *oc = nc + lz * Simulation::TILE;
+
+		for ( size_t x = 0; x < Simulation::TILE; ++x ) {
+			int hc = h[x];
+
+			int out = ( v[ x-1 ] & ( hc - h[ x-1 ] > SLOPE ) )
+				+ ( v[ x+1 ] & ( hc - h[ x+1 ] > SLOPE ) )
+				+ ( v[ x-STRIDE ] & ( hc - h[ x-STRIDE ] > SLOPE ) )
+				+ ( v[ x+STRIDE ] & ( hc - h[ x+STRIDE ] > SLOPE ) );
+
+			int w = v[ x-1 ] & ( h[ x-1 ] - hc > SLOPE );
+			int e = v[ x+1 ] & ( h[ x+1 ] - hc > SLOPE );
+			int n = v[ x-STRIDE ] & ( h[ x-STRIDE ] - hc > SLOPE );
+			int s = v[ x+STRIDE ] & ( h[ x+STRIDE ] - hc > SLOPE );
+
+			int nv = hc - out + w + e + n + s;
+			oh[x] = nv;
+
+			int donor = firstDonor( w, e, n,
+				c[ x-1 ], c[ x+1 ], c[ x-STRIDE ], c[ x+STRIDE ] );
+			oc[x] = newColour( hc, nv, c[x], donor );
+		}
+	}
+}
+
+/*
+ * Every column more than TALUS above a neighbour picks the steepest drop
+ * as its target.  A column takes at most maxHeight - height blocks, from
+ * its senders in west, east, north, south order; a sender whose block
+ * isn't taken keeps it.
+ */
+static void erosionKernel( const int *lh, const int *lc, const int *lv,
+	int maxHeight, int *nh, int *nc )
+{
+	static const int TALUS = 1;
+
+	// Direction each cell sends a block in, or -1, for the tile and two
+	// rings around it.
+	int tg[ LOCAL ];
+	std::fill( tg, tg + LOCAL, -1 );
+
+	for ( size_t lz = PAD - 2; lz < Simulation::TILE + PAD + 2; ++lz ) {
+		for ( size_t lx = PAD - 2; lx < Simulation::TILE + PAD + 2; ++lx ) {
+			int i = lz * STRIDE + lx;
+			if ( !lv[i] ) {
+				continue;
+			}
+
+			// Steepest drop wins; ties go to the first direction.
+			int best = -1;
+			int best_drop = TALUS;
+			for ( int k = 0; k < 4; ++k ) {
+				int j = i + NEIGHBOURS[k];
+				int drop = lv[j] ? lh[i] - lh[j] : 0;
+				if ( drop > best_drop ) {
+					best = k;
+					best_drop = drop;
+				}
+			}
+			tg[i] = best;
+		}
+	}
+
+	// Whether each tile cell's block is taken: its target has room for
+	// it after the senders ahead of it.
+	int sent[ Simulation::TILE * Simulation::TILE ];
+	for ( size_t lz = 0; lz < Simulation::TILE; ++lz ) {
+		for ( size_t lx = 0; lx < Simulation::TILE; ++lx ) {
+			int i = ( lz + PAD ) * STRIDE + lx + PAD;
+			int k = tg[i];
+			int taken = 0;
+			if ( k >= 0 ) {
+				int j = i + NEIGHBOURS[k];
+				int ahead = 0;
+				for ( int d = 0; d < ( k ^ 1 ); ++d ) {
+					ahead += tg[ j + NEIGHBOURS[d] ] == ( d ^ 1 );
+				}
+				taken = ahead < maxHeight - lh[j];
+			}
+			sent[ lz * Simulation::TILE + lx ] = taken;
+		}
+	}
+
+	for ( size_t lz = 0; lz < Simulation::TILE; ++lz ) {
+		const int *h = lh + ( lz + PAD ) * STRIDE + PAD;
+		const int *c = lc + ( lz + PAD ) * STRIDE + PAD;
+		const int *t = tg + ( lz + PAD ) * STRIDE + PAD;
+		const int *out = sent + lz * Simulation::TILE;
+		int *oh = nh + lz * Simulation::TILE;
+		int *oc = nc + lz * Simulation::TILE;
+
+		for ( size_t x = 0; x < Simulation::TILE; ++x ) {
+			// A neighbour sends to us if it points back the way we'd look;
+			// we take as many as there is room for, in order.
+			int room = maxHeight - h[x];
+			int w = t[ x-1 ] == 1;
+			int e = t[ x+1 ] == 0;
+			int n = t[ x-STRIDE ] == 3;
+			int s = t[ x+STRIDE ] == 2;
+			e &= w < room;
+			n &= w + e < room;
+			s &= w + e + n < room;
+			w &= 0 < room;
+
+			int v = h[x] - out[x] + w + e + n + s;
+			oh[x] = v;
+
+			int donor = firstDonor( w, e, n,
+				c[ x-1 ], c[ x+1 ], c[ x-STRIDE ], c[ x+STRIDE ] );
+			oc[x] = newColour( h[x], v, c[x], donor );
+		}
+	}
+}
+
+Simulation::Simulation( size_t dim, int maxHeight )
+	: m_dim( dim )
+	, m_max_height( maxHeight )
+	, m_mode( OFF )
+	, m_tiles_x( ( dim + TILE - 1 ) / TILE )
+	, m_cells_updated( 0 )
+{
+	m_heights = new int[ dim * dim ];
+	m_cols = new int[ dim * dim ];
+
+	m_dirty.resize( m_tiles_x * m_tiles_x );
+	m_changed.resize( m_tiles_x * m_tiles_x );
+	invalidate();
+}
+
+Simulation::~Simulation()
+{
+	delete [] m_heights;
+	delete [] m_cols;
+}
+
+Simulation::Mode Simulation::getMode() const
+{
+	return m_mode;
+}
+
+void Simulation::setMode( Mode mode )
+{
+	if ( mode != m_mode ) {
+		// A grid at rest under one rule needn't be under another.
+		m_mode = mode;
+		invalidate();
+	}
+}
+
+void Simulation::invalidate()
+{
+	std::fill( m_dirty.begin(), m_dirty.end(), 1 );
+}
+
+size_t Simulation::getCellsUpdated() const
+{
+	return m_cells_updated;
+}
+
+bool Simulation::step( Grid &grid )
+{
+	m_cells_updated = 0;
+	if ( m_mode == OFF ) {
+		return false;
+	}
+
+	const int *heights = grid.getHeights();
+	const int *cols = grid.getColours();
+	size_t num_tiles = m_dirty.size();
+
+	std::vector<size_t> active;
+	for ( size_t t = 0; t < num_tiles; ++t ) {
+		if ( m_dirty[t] ) {
+			active.push_back( t );
+		}
+	}
+	if ( active.empty() ) {
+		return false;
+	}
+
+	// Tiles at rest are carried over into the back buffer unchanged.
+	for ( size_t t = 0; t < num_tiles; ++t ) {
+		if ( m_dirty[t] ) {
+			continue;
+		}
+		size_t x0 = ( t % m_tiles_x ) * TILE;
+		size_t z0 = ( t / m_tiles_x ) * TILE;
+		size_t tw = std::min( TILE, m_dim - x0 );
+		size_t th = std::min( TILE, m_dim - z0 );
+		for ( size_t z = z0; z < z0 + th; ++z ) {
+			size_t idx = z * m_dim + x0;
+			memcpy( m_heights + idx, heights + idx, tw * sizeof(int) );
+			memcpy( m_cols + idx, cols + idx, tw * sizeof(int) );
+		}
+	}
+
+	std::fill( m_changed.begin(), m_changed.end(), 0 );
+
+	if ( active.size() < PARALLEL_MIN_TILES ) {
+		for ( size_t t : active ) {
+			m_changed[t] = stepTile( t, heights, cols );
+		}
+	} else {
+		if ( !m_pool ) {
+			m_pool.reset( new ThreadPool() );
+		}
+
+		// One contiguous run of dirty tiles per worker.
+		size_t num_jobs = m_pool->getNumThreads();
+		size_t per_job = ( active.size() + num_jobs - 1 ) / num_jobs;
+		for ( size_t first = 0; first < active.size(); first += per_job ) {
+			size_t last = std::min( first + per_job, active.size() );
+			m_pool->submit( [this, &active, first, last, heights, cols] {
+				for ( size_t i = first; i < last; ++i ) {
+					m_changed[ active[i] ] = stepTile( active[i], heights, cols );
+				}
+			} );
+		}
+		m_pool->wait();
+	}
+
+	for ( size_t t : active ) {
+		size_t x0 = ( t % m_tiles_x ) * TILE;
+		size_t z0 = ( t / m_tiles_x ) * TILE;
+		m_cells_updated += std::min( TILE, m_dim - x0 ) * std::min( TILE, m_dim - z0 );
+	}
+
+	// Whatever changed may set its neighbours moving next step.
+	bool any = false;
+	std::fill( m_dirty.begin(), m_dirty.end(), 0 );
+	for ( size_t t = 0; t < num_tiles; ++t ) {
+		if ( !m_changed[t] ) {
+			continue;
+		}
+		any = true;
+
+		int tx = int( t % m_tiles_x );
+		int tz = int( t / m_tiles_x );
+		for ( int dz = -1; dz <= 1; ++dz ) {
+			for ( int dx = -1; dx <= 1; ++dx ) {
+				int nx = tx + dx;
+				int nz = tz + dz;
+				if ( nx >= 0 && nz >= 0 && nx < int( m_tiles_x ) && nz < int( m_tiles_x ) ) {
+					m_dirty[ nz * m_tiles_x + nx ] = 1;
+				}
+			}
+		}
+	}
+
+	grid.swapStorage( m_heights, m_cols );
+
+	return any;
+}
+
+/*
+ * Computes one tile into the back buffer.  Returns true if any of its
+ * cells changed.
+ */
+bool Simulation::stepTile( size_t tile, const int *heights, const int *cols )
+{
+	size_t x0 = ( tile % m_tiles_x ) * TILE;
+	size_t z0 = ( tile / m_tiles_x ) * TILE;
+	size_t tw = std::min( TILE, m_dim - x0 );
+	size_t th = std::min( TILE, m_dim - z0 );
+
+	int lh[ LOCAL ];
+	int lc[ LOCAL ];
+	int lv[ LOCAL ];
+	for ( int lz = 0; lz < STRIDE; ++lz ) {
+		long gz = long( z0 ) + lz - PAD;
+		for ( int lx = 0; lx < STRIDE; ++lx ) {
+			long gx = long( x0 ) + lx - PAD;
+			int i = lz * STRIDE + lx;
+			bool valid = gx >= 0 && gz >= 0 && gx < long( m_dim ) && gz < long( m_dim );
+			lh[i] = valid ? heights[ gz * m_dim + gx ] : 0;
+			lc[i] = valid ? cols[ gz * m_dim + gx ] : 0;
+			lv[i] = valid;
+		}
+	}
+
+	int nh[ TILE * TILE ];
+	int nc[ TILE * TILE ];
+	switch ( m_mode ) {
+	case SANDPILE:
+		sandpileKernel( lh, lc, m_max_height, nh, nc );
+		break;
+	case EROSION:
+		erosionKernel( lh, lc, lv, m_max_height, nh, nc );
+		break;
+	case GRAVITY:
+		gravityKernel( lh, lc, lv, nh, nc );
+		break;
+	default:
+		return false;
+	}
+
+	bool changed = false;
+	for ( size_t lz = 0; lz < th; ++lz ) {
+		size_t idx = ( z0 + lz ) * m_dim + x0;
+		const int *oh = nh + lz * TILE;
+		const int *oc = nc + lz * TILE;
+		changed = changed
+			|| memcmp( oh, heights + idx, tw * sizeof(int) ) != 0
+			|| memcmp( oc, cols + idx, tw * sizeof(int) ) != 0;
+		memcpy( m_heights + idx, oh, tw * sizeof(int) );
+		memcpy( m_cols + idx, oc, tw * sizeof(int) );
+	}
+
+	return changed;
+}
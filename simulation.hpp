@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "grid.hpp"
+#include "thread_pool.hpp"
+
+/*
+ * Cellular rules run on the grid's height field, one step at a time:
+ *
+ *   SANDPILE  a column of 4 or more topples, giving one block to each
+ *             neighbour (blocks falling off the edge, or landing on a
+ *             full column, are lost).
+ *   EROSION   a column more than 1 above its lowest neighbour moves one
+ *             block onto it, if that neighbour has room.
+ *   GRAVITY   a column more than 3 above a neighbour spills one block
+ *             onto each such neighbour.
+ *
+ * A block landing on an empty column gives it the colour it came from.
+ *
+ * Each step reads the grid and writes a back buffer that is then swapped
+ * in.  The grid is processed in square tiles, spread over worker threads
+ * when enough of them need work; only tiles that changed in the last
+ * step (and their neighbours) are recomputed, the rest are copied.
+ */
+class Simulation
+{
+public:
+	enum Mode {
+		OFF,
+		SANDPILE,
+		EROSION,
+		GRAVITY
+	};
+
+	static const size_t TILE = 8;
+
+	Simulation( size_t dim, int maxHeight );
+	~Simulation();
+
+	Mode getMode() const;
+	void setMode( Mode mode );
+
+	// Call when the grid was changed from outside; every tile is redone.
+	void invalidate();
+
+	// Advances the grid one step.  Returns true if any cell changed.
+	bool step( Grid &grid );
+
+	// Cells computed (not just copied) by the last step.
+	size_t getCellsUpdated() const;
+
+private:
+	bool stepTile( size_t tile, const int *heights, const int *cols );
+
+	size_t m_dim;
+	int m_max_height;
+	Mode m_mode;
+
+	// Back buffer, swapped with the grid's storage every step.
+	int *m_heights;
+	int *m_cols;
+
+	size_t m_tiles_x; // tiles per side
+	std::vector<char> m_dirty;
+	std::vector<char> m_changed;
+	size_t m_cells_updated;
+
+	std::unique_ptr<ThreadPool> m_pool;
+};
@@ -0,0 +1,213 @@
+#include <cstring>
+
+#include "stream_buffer.hpp"
+#include "cs488-framework/GlErrorCheck.hpp"
+
+// How long map() blocks on a fence between checks (ns).
+static const GLuint64 FENCE_TIMEOUT = 1000000000;
+
+/*
+ * glBufferStorage is core in 4.4 and otherwise only available through
+ * ARB_buffer_storage.  Headers that predate it (e.g. OS X's gl3.h) don't
+ * declare it at all, in which case we always orphan.
+ */
+static bool hasBufferStorage()
+{
+#ifdef GL_MAP_PERSISTENT_BIT
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv( GL_MAJOR_VERSION, &major );
+	glGetIntegerv( GL_MINOR_VERSION, &minor );
+	if ( major > 4 || ( major == 4 && minor >= 4 ) ) {
+		return true;
+	}
+
+	GLint num_ext = 0;
+	glGetIntegerv( GL_NUM_EXTENSIONS, &num_ext );
+	for ( GLint i = 0; i < num_ext; ++i ) {
+		const char *ext = (const char *)glGetStringi( GL_EXTENSIONS, i );
+		if ( ext && strcmp( ext, "GL_ARB_buffer_storage" ) == 0 ) {
+			return true;
+		}
+	}
+#endif
+	return false;
+}
+
+StreamBuffer::StreamBuffer()
+	: m_target( GL_ARRAY_BUFFER )
+	, m_buffer( 0 )
+	, m_region_size( 0 )
+	, m_region( 0 )
+	, m_persistent( false )
+	, m_ptr( nullptr )
+	, m_fence_waits( 0 )
+	, m_frames( 0 )
+{
+	for ( int i = 0; i < NUM_REGIONS; ++i ) {
+		m_fences[ i ] = 0;
+	}
+}
+
+void StreamBuffer::init( GLenum target, size_t regionSize )
+{
+	m_target = target;
+	m_region_size = regionSize;
+	m_region = 0;
+	m_persistent = hasBufferStorage();
+
+	GLsizeiptr total = GLsizeiptr( regionSize * NUM_REGIONS );
+
+	glGenBuffers( 1, &m_buffer );
+	glBindBuffer( m_target, m_buffer );
+
+#ifdef GL_MAP_PERSISTENT_BIT
+	if ( m_persistent ) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT
+			| GL_MAP_COHERENT_BIT;
+		glBufferStorage( m_target, total, nullptr, flags );
+		m_ptr = (char *)glMapBufferRange( m_target, 0, total, flags );
+		if ( !m_ptr ) {
+			// Storage is immutable now, so start over with a fresh name.
+			glBindBuffer( m_target, 0 );
+			glDeleteBuffers( 1, &m_buffer );
+			glGenBuffers( 1, &m_buffer );
+			glBindBuffer( m_target, m_buffer );
+			m_persistent = false;
+		}
+	}
+#endif
+
+	if ( !m_persistent ) {
+		glBufferData( m_target, total, nullptr, GL_STREAM_DRAW );
+	}
+
+	glBindBuffer( m_target, 0 );
+	CHECK_GL_ERRORS;
+}
+
+void StreamBuffer::destroy()
+{
+	for ( int i = 0; i < NUM_REGIONS; ++i ) {
+		if ( m_fences[ i ] ) {
+			glDeleteSync( m_fences[ i ] );
+			m_fences[ i ] = 0;
+		}
+	}
+
+	if ( m_buffer ) {
+		if ( m_ptr ) {
+			glBindBuffer( m_target, m_buffer );
+			glUnmapBuffer( m_target );
+			glBindBuffer( m_target, 0 );
+			m_ptr = nullptr;
+		}
+		glDeleteBuffers( 1, &m_buffer );
+		m_buffer = 0;
+	}
+}
+
+/*
+ * Returns a write pointer to the current frame's region, waiting for the
+ * GPU to finish with it first if it was used three frames ago.
+ */
+void *StreamBuffer::map()
+{
+	size_t offset = m_region * m_region_size;
+
+	if ( m_persistent ) {
+		waitRegion( m_region );
+		return m_ptr + offset;
+	}
+
+	glBindBuffer( m_target, m_buffer );
+	if ( m_region == 0 ) {
+		// Wrapped around: hand the old storage back to the driver.
+		glBufferData( m_target, GLsizeiptr( m_region_size * NUM_REGIONS ),
+			nullptr, GL_STREAM_DRAW );
+	}
+	void *ptr = glMapBufferRange( m_target, offset, m_region_size,
+		GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+		| GL_MAP_INVALIDATE_RANGE_BIT );
+	glBindBuffer( m_target, 0 );
+
+	return ptr;
+}
+
+/*
+ * Finishes writing and returns the byte offset of the region in the buffer.
+ */
+GLintptr StreamBuffer::unmap()
+{
+	if ( !m_persistent ) {
+		glBindBuffer( m_target, m_buffer );
+		glUnmapBuffer( m_target );
+		glBindBuffer( m_target, 0 );
+	}
+
+	return GLintptr( m_region * m_region_size );
+}
+
+/*
+ * Call once every draw reading from the current region has been issued.
+ */
+void StreamBuffer::fence()
+{
+	if ( m_persistent ) {
+		if ( m_fences[ m_region ] ) {
+			glDeleteSync( m_fences[ m_region ] );
+		}
+		m_fences[ m_region ] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	}
+
+	m_region = ( m_region + 1 ) % NUM_REGIONS;
+	++m_frames;
+}
+
+void StreamBuffer::waitRegion( int region )
+{
+	GLsync sync = m_fences[ region ];
+	if ( !sync ) {
+		return;
+	}
+
+	GLenum res = glClientWaitSync( sync, 0, 0 );
+	if ( res == GL_TIMEOUT_EXPIRED ) {
+		++m_fence_waits;
+		do {
+			res = glClientWaitSync( sync, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT );
+		} while ( res == GL_TIMEOUT_EXPIRED );
+	}
+	if ( res == GL_WAIT_FAILED ) {
+		// The fence can't tell us anything; wait for everything instead.
+		glFinish();
+	}
+
+	glDeleteSync( sync );
+	m_fences[ region ] = 0;
+}
+
+GLuint StreamBuffer::getBuffer() const
+{
+	return m_buffer;
+}
+
+size_t StreamBuffer::getRegionSize() const
+{
+	return m_region_size;
+}
+
+bool StreamBuffer::isPersistent() const
+{
+	return m_persistent;
+}
+
+unsigned StreamBuffer::getFenceWaits() const
+{
+	return m_fence_waits;
+}
+
+unsigned StreamBuffer::getFrames() const
+{
+	return m_frames;
+}
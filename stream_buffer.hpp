@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+
+#include "cs488-framework/OpenGLImport.hpp"
+
+/*
+ * A ring of three per-frame regions inside one GL buffer, used to stream
+ * dynamic vertex data without stalling on the driver.
+ *
+ * When the context supports buffer storage the whole buffer is mapped
+ * persistently once and each region is guarded by a fence; otherwise the
+ * buffer is orphaned whenever the ring wraps and each region is mapped
+ * unsynchronized.
+ *
+ * Per frame: map(), write at most getRegionSize() bytes, unmap() to get
+ * the region's byte offset for attribute pointers, issue the draws, then
+ * fence().
+ */
+class StreamBuffer
+{
+public:
+	static const int NUM_REGIONS = 3;
+
+	StreamBuffer();
+
+	void init( GLenum target, size_t regionSize );
+	void destroy();
+
+	void *map();
+	GLintptr unmap();
+	void fence();
+
+	GLuint getBuffer() const;
+	size_t getRegionSize() const;
+	bool isPersistent() const;
+
+	// Number of map() calls that found their region still in use by the GPU.
+	unsigned getFenceWaits() const;
+	unsigned getFrames() const;
+
+private:
+	void waitRegion( int region );
+
+	GLenum m_target;
+	GLuint m_buffer;
+	size_t m_region_size;
+	int m_region;
+
+	bool m_persistent;
+	char *m_ptr;
+	GLsync m_fences[ NUM_REGIONS ];
+
+	unsigned m_fence_waits;
+	unsigned m_frames;
+};
@@ -0,0 +1,83 @@
+#include <algorithm>
+
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool( size_t numThreads )
+	: m_busy( 0 )
+	, m_stop( false )
+{
+	if ( numThreads == 0 ) {
+		numThreads = std::max( 1u, std::thread::hardware_concurrency() );
+	}
+
+	for ( size_t i = 0; i < numThreads; ++i ) {
+		m_threads.push_back( std::thread( &ThreadPool::run, this ) );
+	}
+}
+
+/*
+ * Finishes every queued job before joining the workers.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_stop = true;
+	}
+	m_work_cv.notify_all();
+
+	for ( std::thread &t : m_threads ) {
+		t.join();
+	}
+}
+
+size_t ThreadPool::getNumThreads() const
+{
+	return m_threads.size();
+}
+
+void ThreadPool::submit( const std::function<void()> &job )
+{
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_jobs.push_back( job );
+	}
+	m_work_cv.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	m_idle_cv.wait( lock, [this] { return m_jobs.empty() && m_busy == 0; } );
+}
+
+size_t ThreadPool::getPending() const
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	return m_jobs.size() + m_busy;
+}
+
+void ThreadPool::run()
+{
+	for ( ;; ) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock( m_mutex );
+			m_work_cv.wait( lock, [this] { return m_stop || !m_jobs.empty(); } );
+			if ( m_jobs.empty() ) {
+				return;
+			}
+			job = m_jobs.front();
+			m_jobs.pop_front();
+			++m_busy;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			--m_busy;
+		}
+		m_idle_cv.notify_all();
+	}
+}
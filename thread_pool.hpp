@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed set of worker threads pulling jobs off a FIFO queue.
+ */
+class ThreadPool
+{
+public:
+	// 0 threads means one per hardware thread.
+	ThreadPool( size_t numThreads = 0 );
+	~ThreadPool();
+
+	size_t getNumThreads() const;
+
+	void submit( const std::function<void()> &job );
+
+	// Blocks until every submitted job has finished.
+	void wait();
+
+	// Jobs queued or running.
+	size_t getPending() const;
+
+private:
+	void run();
+
+	std::vector<std::thread> m_threads;
+	std::deque< std::function<void()> > m_jobs;
+	size_t m_busy;
+	bool m_stop;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_work_cv;
+	std::condition_variable m_idle_cv;
+};